@@ -4,22 +4,18 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 O_SRCS += \
-../gc.o \
-../main.o 
+../gc.o 
 
 CPP_SRCS += \
 ../gc.cpp \
-../main.cpp \
 ../main_smartptr.cpp 
 
 OBJS += \
 ./gc.o \
-./main.o \
 ./main_smartptr.o 
 
 CPP_DEPS += \
 ./gc.d \
-./main.d \
 ./main_smartptr.d 
 
 
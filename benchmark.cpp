@@ -0,0 +1,580 @@
+#include "gc.h"
+#include "gcPtr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+
+/*****************************************************************************
+    BENCHMARK
+
+    Each scenario runs the same workload with garbage-collected pointers
+    (gc::Pointer), reference-counted pointers (GCPtr) and plain pointers
+    that are deleted by hand. The workloads are deterministic, and each one
+    is repeated; the median run is reported. Results are printed as one
+    JSON object per line.
+
+    usage: benchmark [--repeat N] [--scale F] [--pointer gc|rc|new]
+                     [scenario...]
+ *****************************************************************************/
+
+
+//times of a run are the median of this many runs, by default
+#define DEFAULT_REPEAT       3
+
+
+//max threads of the thread scaling scenario
+#define MAX_THREADS          8
+
+
+//current time in seconds
+static double now()
+{
+#ifdef WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+
+//random numbers; every run draws the same ones
+struct Random {
+    unsigned long long state;
+
+    Random() : state(0x2545f4914f6cdd1dULL) {
+    }
+
+    unsigned next(unsigned range) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned)(state >> 33) % range;
+    }
+};
+
+
+//scale of the workloads
+static double scale = 1;
+
+
+//number of operations of a workload, scaled
+static size_t scaled(size_t count)
+{
+    size_t n = (size_t)(count * scale);
+    return n ? n : 1;
+}
+
+
+/*****************************************************************************
+    POINTER KINDS
+ *****************************************************************************/
+
+
+//garbage-collected pointers; garbage is freed by the collector; the test
+//classes have nothing to finalize, and worker threads are registered with
+//the heap
+struct Collected {
+    typedef gc::TrivialObject Base;
+    typedef gc::MutatorScope Mutator;
+    template <class T> struct Ptr { typedef gc::Pointer<T> Type; };
+    static const char *name() { return "gc"; }
+    static bool threaded() { return GC_MULTITHREADED == 1; }
+    template <class T> static void dispose(T &) {}
+    template <class T> static void unlink(T &) {}
+};
+
+
+//reference-counted pointers; reference counting can not free cycles, so
+//they are unlinked by hand
+struct Counted {
+    typedef GCObject Base;
+    struct Mutator { Mutator() {} };
+    template <class T> struct Ptr { typedef GCPtr<T> Type; };
+    static const char *name() { return "rc"; }
+    static bool threaded() { return true; }
+    template <class T> static void dispose(T &) {}
+    template <class T> static void unlink(T &p) { p = 0; }
+};
+
+
+//plain pointers; objects are deleted by hand
+struct Plain {
+    struct Base { virtual ~Base() {} };
+    struct Mutator { Mutator() {} };
+    template <class T> struct Ptr { typedef T *Type; };
+    static const char *name() { return "new"; }
+    static bool threaded() { return true; }
+    template <class T> static void dispose(T &p) { delete p; p = 0; }
+    template <class T> static void unlink(T &p) { p = 0; }
+};
+
+
+/*****************************************************************************
+    TEST CLASSES
+ *****************************************************************************/
+
+
+//simple class
+template <class P> class Simple : public P::Base {
+public:
+    int value;
+};
+
+
+//big
+template <class P> class Big : public P::Base {
+public:
+    int m_data[500];
+};
+
+
+template <class P> class Foo1;
+
+
+//used for reference testing
+template <class P> class Bar1 : public P::Base {
+public:
+    typename P::template Ptr< Foo1<P> >::Type foo1;
+
+    Bar1() : foo1(0) {
+    }
+};
+
+
+//used for reference testing
+template <class P> class Foo1 : public P::Base {
+public:
+    typename P::template Ptr< Bar1<P> >::Type bar1;
+
+    Foo1() : bar1(0) {
+    }
+};
+
+
+//complex class; its parts point to each other
+template <class P> class Complex : public P::Base {
+public:
+    typename P::template Ptr< Big<P> >::Type ptr1;
+    typename P::template Ptr< Bar1<P> >::Type bar1;
+    typename P::template Ptr< Foo1<P> >::Type foo1;
+
+    Complex() : ptr1(new Big<P>), bar1(new Bar1<P>), foo1(new Foo1<P>) {
+        bar1->foo1 = foo1;
+        foo1->bar1 = bar1;
+    }
+
+    ~Complex() {
+        P::unlink(foo1->bar1);
+        P::dispose(ptr1);
+        P::dispose(bar1);
+        P::dispose(foo1);
+    }
+};
+
+
+//node of a binary tree; a node owns its children
+template <class P> class Node : public P::Base {
+public:
+    typename P::template Ptr< Node<P> >::Type left;
+    typename P::template Ptr< Node<P> >::Type right;
+
+    Node() : left(0), right(0) {
+    }
+
+    ~Node() {
+        P::dispose(left);
+        P::dispose(right);
+    }
+};
+
+
+//link of a ring; a link owns the next one
+template <class P> class Link : public P::Base {
+public:
+    typename P::template Ptr< Link<P> >::Type next;
+
+    Link() : next(0) {
+    }
+
+    ~Link() {
+        P::dispose(next);
+    }
+};
+
+
+//build a tree of the given depth
+template <class P> static typename P::template Ptr< Node<P> >::Type build(int depth)
+{
+    typename P::template Ptr< Node<P> >::Type node = new Node<P>;
+    if (depth > 0) {
+        node->left = build<P>(depth - 1);
+        node->right = build<P>(depth - 1);
+    }
+    return node;
+}
+
+
+/*****************************************************************************
+    RESULTS
+ *****************************************************************************/
+
+
+//result of a run of a scenario
+struct Result {
+    double seconds;
+    size_t ops;
+    size_t collections;
+    std::vector<double> latencies;
+    std::vector<double> pauses;
+};
+
+
+//percentile of sorted values
+static double percentile(const std::vector<double> &values, double p)
+{
+    if (values.empty()) return 0;
+    size_t i = (size_t)(p * (values.size() - 1) + 0.5);
+    return values[i];
+}
+
+
+//print a result as a line of JSON
+static void print(const char *scenario, const char *pointer, int threads, Result &result)
+{
+    printf("{\"scenario\":\"%s\",\"pointer\":\"%s\",\"threads\":%d,\"ops\":%lu,\"seconds\":%.6f,\"ops_per_sec\":%.0f",
+        scenario, pointer, threads, (unsigned long)result.ops, result.seconds, result.ops / result.seconds);
+    if (!strcmp(pointer, "gc")) printf(",\"collections\":%lu", (unsigned long)result.collections);
+    if (!result.latencies.empty()) {
+        std::sort(result.latencies.begin(), result.latencies.end());
+        printf(",\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"max_us\":%.2f",
+            percentile(result.latencies, 0.5), percentile(result.latencies, 0.9), percentile(result.latencies, 0.99),
+            percentile(result.latencies, 0.999), result.latencies.back());
+    }
+    if (!result.pauses.empty()) {
+        std::sort(result.pauses.begin(), result.pauses.end());
+        printf(",\"gc_pauses\":%lu,\"gc_pause_p50_us\":%.0f,\"gc_pause_p99_us\":%.0f,\"gc_pause_max_us\":%.0f",
+            (unsigned long)result.pauses.size(), percentile(result.pauses, 0.5), percentile(result.pauses, 0.99),
+            result.pauses.back());
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+//print a scenario that was not run
+static void skip(const char *scenario, const char *pointer, const char *reason)
+{
+    printf("{\"scenario\":\"%s\",\"pointer\":\"%s\",\"skipped\":\"%s\"}\n", scenario, pointer, reason);
+    fflush(stdout);
+}
+
+
+//the pauses of the collections are recorded while a result wants them
+static Result *pause_result = 0;
+
+
+//records the pause of a collection
+static void record_pause(const gc::CollectionStats &stats, void *)
+{
+    if (pause_result) pause_result->pauses.push_back((double)stats.pauseMicros);
+}
+
+
+/*****************************************************************************
+    SCENARIOS
+ *****************************************************************************/
+
+
+//allocation throughput of small objects; one object is live at a time
+template <class P> static void run_alloc(Result &result)
+{
+    typename P::template Ptr< Simple<P> >::Type p = 0;
+    size_t count = scaled(4000000);
+    for(size_t i = 0; i < count; ++i) {
+        P::dispose(p);
+        p = new Simple<P>;
+    }
+    P::dispose(p);
+    result.ops = count;
+}
+
+
+//allocation throughput of big objects, as the old performance test
+template <class P> static void run_big(Result &result)
+{
+    typename P::template Ptr< Big<P> >::Type p = 0;
+    size_t count = scaled(400000);
+    for(size_t i = 0; i < count; ++i) {
+        P::dispose(p);
+        p = new Big<P>;
+    }
+    P::dispose(p);
+    result.ops = count;
+}
+
+
+//graphs of objects that point to each other, as the old complex test
+template <class P> static void run_complex(Result &result)
+{
+    typename P::template Ptr< Complex<P> >::Type p = 0;
+    size_t count = scaled(200000);
+    for(size_t i = 0; i < count; ++i) {
+        P::dispose(p);
+        p = new Complex<P>;
+    }
+    P::dispose(p);
+    result.ops = count;
+}
+
+
+//rings of objects that become garbage at once
+template <class P> static void run_cycles(Result &result)
+{
+    const int length = 16;
+    size_t count = scaled(100000);
+    for(size_t i = 0; i < count; ++i) {
+        typename P::template Ptr< Link<P> >::Type head = new Link<P>;
+        typename P::template Ptr< Link<P> >::Type last = head;
+        for(int j = 1; j < length; ++j) {
+            last->next = new Link<P>;
+            last = last->next;
+        }
+        last->next = head;
+
+        //the ring is dropped
+        P::unlink(last->next);
+        last = 0;
+        P::dispose(head);
+    }
+    result.ops = count * length;
+}
+
+
+//trees that are built and dropped while a big tree is live
+template <class P> static void run_tree(Result &result)
+{
+    //the live tree stays within the default block limit of the collector
+    typename P::template Ptr< Node<P> >::Type live = build<P>(16);
+    size_t count = scaled(40);
+    for(size_t i = 0; i < count; ++i) {
+        typename P::template Ptr< Node<P> >::Type temp = build<P>(14);
+        P::dispose(temp);
+    }
+    P::dispose(live);
+    result.ops = count * ((1 << 15) - 1) + (1 << 17) - 1;
+}
+
+
+//subtrees of a live tree are replaced; the latency of each replacement is
+//recorded, along with the pauses of the collector
+template <class P> static void run_latency(Result &result)
+{
+    Random random;
+    typename P::template Ptr< Node<P> >::Type live = build<P>(16);
+    size_t count = scaled(100000);
+    result.latencies.reserve(count);
+    for(size_t i = 0; i < count; ++i) {
+        double start = now();
+
+        //walk down a random path, and replace a subtree at its end
+        typename P::template Ptr< Node<P> >::Type node = live;
+        for(int depth = 0; depth < 9; ++depth) {
+            node = random.next(2) ? node->left : node->right;
+        }
+        if (random.next(2)) {
+            P::dispose(node->left);
+            node->left = build<P>(6);
+        }
+        else {
+            P::dispose(node->right);
+            node->right = build<P>(6);
+        }
+
+        result.latencies.push_back((now() - start) * 1e6);
+    }
+    P::dispose(live);
+    result.ops = count;
+}
+
+
+//context of a thread of the thread scaling scenario
+template <class P> struct Worker {
+    size_t count;
+#ifdef WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+};
+
+
+//allocates small objects in a thread
+#ifdef WIN32
+template <class P> DWORD CALLBACK worker_proc(LPVOID param)
+#else
+template <class P> void *worker_proc(void *param)
+#endif
+{
+    Worker<P> *worker = (Worker<P> *)param;
+    typename P::Mutator mutator;
+    typename P::template Ptr< Simple<P> >::Type p = 0;
+    for(size_t i = 0; i < worker->count; ++i) {
+        P::dispose(p);
+        p = new Simple<P>;
+    }
+    P::dispose(p);
+    return 0;
+}
+
+
+//allocation throughput of small objects in many threads; each thread
+//allocates as many objects as a single one does
+template <class P> static void run_threads(Result &result, int threads)
+{
+    Worker<P> workers[MAX_THREADS];
+    for(int i = 0; i < threads; ++i) {
+        workers[i].count = scaled(2000000);
+#ifdef WIN32
+        workers[i].thread = CreateThread(0, 0, worker_proc<P>, &workers[i], 0, 0);
+#else
+        pthread_create(&workers[i].thread, NULL, worker_proc<P>, &workers[i]);
+#endif
+    }
+    for(int i = 0; i < threads; ++i) {
+#ifdef WIN32
+        WaitForSingleObject(workers[i].thread, INFINITE);
+        CloseHandle(workers[i].thread);
+#else
+        pthread_join(workers[i].thread, NULL);
+#endif
+    }
+    result.ops = workers[0].count * threads;
+}
+
+
+/*****************************************************************************
+    DRIVER
+ *****************************************************************************/
+
+
+//times of a run are the median of this many runs
+static int repeat = DEFAULT_REPEAT;
+
+
+//scenarios
+enum Scenario { ALLOC, BIG, COMPLEX, CYCLES, TREE, LATENCY, THREADS, SCENARIOS };
+static const char *scenario_names[SCENARIOS] = {
+    "alloc", "big", "complex", "cycles", "tree", "latency", "threads"
+};
+
+
+//runs a scenario once
+template <class P> static void run_once(Scenario scenario, int threads, Result &result)
+{
+    switch (scenario) {
+        case ALLOC: run_alloc<P>(result); break;
+        case BIG: run_big<P>(result); break;
+        case COMPLEX: run_complex<P>(result); break;
+        case CYCLES: run_cycles<P>(result); break;
+        case TREE: run_tree<P>(result); break;
+        case LATENCY: run_latency<P>(result); break;
+        case THREADS: run_threads<P>(result, threads); break;
+        default: break;
+    }
+}
+
+
+//runs a scenario as many times as asked and prints the median run; the
+//garbage of a run is collected before the next one starts
+template <class P> static void run(Scenario scenario, int threads)
+{
+    std::vector<Result> results(repeat);
+    std::vector< std::pair<double, int> > order;
+    for(int r = 0; r < repeat; ++r) {
+        Result &result = results[r];
+        gc::collectGarbage();
+        size_t collections = gc::getStats().collections + gc::getStats().minorCollections;
+        pause_result = &result;
+        double start = now();
+        run_once<P>(scenario, threads, result);
+        result.seconds = now() - start;
+        pause_result = 0;
+        result.collections = gc::getStats().collections + gc::getStats().minorCollections - collections;
+        order.push_back(std::make_pair(result.seconds, r));
+    }
+    std::sort(order.begin(), order.end());
+    print(scenario_names[scenario], P::name(), threads, results[order[repeat / 2].second]);
+}
+
+
+//runs a scenario with a kind of pointers
+template <class P> static void run(Scenario scenario)
+{
+    if (scenario != THREADS) {
+        run<P>(scenario, 1);
+        return;
+    }
+    if (!P::threaded()) {
+        skip(scenario_names[scenario], P::name(), "single-threaded collector");
+        return;
+    }
+    for(int threads = 1; threads <= MAX_THREADS; threads *= 2) run<P>(scenario, threads);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *pointer = 0;
+    bool selected[SCENARIOS] = { false };
+    bool any = false;
+
+    //parse the arguments
+    for(int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+            if (repeat < 1) repeat = 1;
+        }
+        else if (!strcmp(argv[i], "--scale") && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--pointer") && i + 1 < argc) {
+            pointer = argv[++i];
+        }
+        else {
+            int s;
+            for(s = 0; s < SCENARIOS && strcmp(argv[i], scenario_names[s]); ++s);
+            if (s == SCENARIOS) {
+                fprintf(stderr, "usage: %s [--repeat N] [--scale F] [--pointer gc|rc|new] [scenario...]\n", argv[0]);
+                fprintf(stderr, "scenarios: alloc big complex cycles tree latency threads\n");
+                return 1;
+            }
+            selected[s] = any = true;
+        }
+    }
+
+    //the pauses of the collector are recorded
+    gc::setCollectionCallback(record_pause);
+
+    //run the scenarios
+    for(int s = 0; s < SCENARIOS; ++s) {
+        if (any && !selected[s]) continue;
+        if (!pointer || !strcmp(pointer, Collected::name())) run<Collected>((Scenario)s);
+        if (!pointer || !strcmp(pointer, Counted::name())) run<Counted>((Scenario)s);
+        if (!pointer || !strcmp(pointer, Plain::name())) run<Plain>((Scenario)s);
+    }
+    return 0;
+}
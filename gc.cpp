@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 //include files for locking
@@ -16,469 +17,5051 @@
 #include <windows.h>
 #else
 #include <pthread.h>
+#include <sys/mman.h>
 #endif
 
 
-//multithreaded
+//software prefetching
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+static inline void prefetch(const void *p) { _mm_prefetch((const char *)p, _MM_HINT_T0); }
+#else
+static inline void prefetch(const void *p) { __builtin_prefetch(p); }
+#endif
+
+
+//index of the highest and lowest set bits of a non-zero word, and number
+//of set bits of a word
+#ifdef _MSC_VER
+#include <intrin.h>
+#ifdef _WIN64
+static inline size_t highestBit(size_t w) { unsigned long i; _BitScanReverse64(&i, w); return i; }
+static inline size_t lowestBit(size_t w) { unsigned long i; _BitScanForward64(&i, w); return i; }
+static inline size_t bitCount(size_t w) { return __popcnt64(w); }
+#else
+static inline size_t highestBit(size_t w) { unsigned long i; _BitScanReverse(&i, w); return i; }
+static inline size_t lowestBit(size_t w) { unsigned long i; _BitScanForward(&i, w); return i; }
+static inline size_t bitCount(size_t w) { return __popcnt(w); }
+#endif
+#else
+static inline size_t highestBit(size_t w) { return sizeof(long long) * 8 - 1 - __builtin_clzll(w); }
+static inline size_t lowestBit(size_t w) { return __builtin_ctzll(w); }
+static inline size_t bitCount(size_t w) { return __builtin_popcountll(w); }
+#endif
+
+
+//a concurrent collector needs a multithreaded one
+#if GC_CONCURRENT == 1 && GC_MULTITHREADED == 0
+#error "GC_CONCURRENT requires GC_MULTITHREADED"
+#endif
+
+
+//spilling of the registers to the stack, so as that a scan of the stack
+//finds the pointers they hold, and the frame of the calling function, which
+//the frames of its callers are above
+#if GC_CONSERVATIVE == 1
+#ifdef __GNUC__
+#define SPILL_REGISTERS() __builtin_unwind_init()
+#define FRAME_ADDRESS() ((char *)__builtin_frame_address(0))
+#define NOINLINE __attribute__((noinline))
+#else
+#include <setjmp.h>
+#include <intrin.h>
+#define SPILL_REGISTERS() jmp_buf regs; setjmp(regs)
+#define FRAME_ADDRESS() ((char *)_AddressOfReturnAddress())
+#define NOINLINE __declspec(noinline)
+#endif
+#ifdef __SANITIZE_ADDRESS__
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+#endif
+
+
+//virtual memory; address space is reserved first, and its pages are
+//committed as they are used and decommitted when they are freed
+#ifdef WIN32
+static void *reserveMemory(size_t size) { return VirtualAlloc(0, size, MEM_RESERVE, PAGE_READWRITE); }
+static bool commitMemory(void *p, size_t size) { return VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) != 0; }
+static void decommitMemory(void *p, size_t size) { VirtualFree(p, size, MEM_DECOMMIT); }
+static void releaseMemory(void *p, size_t) { VirtualFree(p, 0, MEM_RELEASE); }
+static inline void adviseHugePages(void *, size_t) {}
+#else
+// POSIX platforms; reserved pages are committed by the first access to them
+static void *reserveMemory(size_t size) {
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? 0 : p;
+}
+static bool commitMemory(void *, size_t) { return true; }
+static void decommitMemory(void *p, size_t size) { madvise(p, size, MADV_DONTNEED); }
+static void releaseMemory(void *p, size_t size) { munmap(p, size); }
+#ifdef MADV_HUGEPAGE
+static inline void adviseHugePages(void *p, size_t size) { madvise(p, size, MADV_HUGEPAGE); }
+#else
+static inline void adviseHugePages(void *, size_t) {}
+#endif
+#endif
+
+//write to each page of a range, so as that the system backs it with memory
+static inline void prefaultMemory(void *p, size_t size) {
+    for(size_t i = 0; i < size; i += 4096) ((volatile char *)p)[i] = 0;
+}
+
+
+//threads of the collector itself, and thread-local data of the mutators
+#if GC_MULTITHREADED == 1 || GC_MARK_THREADS > 1
+
+//win32 threads
+#ifdef WIN32
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define THREAD_PROC(name) DWORD CALLBACK name(LPVOID param)
+#define THREAD_LOCAL __declspec(thread)
+typedef DWORD threadkey_t;
+#define THREAD_EXIT_PROC(name) VOID WINAPI name(PVOID param)
+static inline void startThread(thread_t *t, LPTHREAD_START_ROUTINE proc, void *param) { *t = CreateThread(0, 0, proc, param, 0, 0); }
+static inline void joinThread(thread_t t) { WaitForSingleObject(t, INFINITE); CloseHandle(t); }
+static inline void yieldThread() { SwitchToThread(); }
+static inline void initMutex(mutex_t *m) { InitializeCriticalSection(m); }
+static inline void deleteMutex(mutex_t *m) { DeleteCriticalSection(m); }
+static inline void lockMutex(mutex_t *m) { EnterCriticalSection(m); }
+static inline void unlockMutex(mutex_t *m) { LeaveCriticalSection(m); }
+static inline void initCond(cond_t *c) { InitializeConditionVariable(c); }
+static inline void deleteCond(cond_t *) {}
+static inline void waitCond(cond_t *c, mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static inline void notifyCond(cond_t *c) { WakeAllConditionVariable(c); }
+static inline void initThreadKey(threadkey_t *k, PFLS_CALLBACK_FUNCTION proc) { *k = FlsAlloc(proc); }
+static inline void deleteThreadKey(threadkey_t k) { FlsFree(k); }
+static inline void setThreadKey(threadkey_t k, void *v) { FlsSetValue(k, v); }
+#ifdef _WIN64
+static inline size_t atomicAdd(volatile size_t *p, size_t v) { return InterlockedExchangeAdd64((volatile LONG64 *)p, v) + v; }
+static inline size_t atomicOr(volatile size_t *p, size_t v) { return InterlockedOr64((volatile LONG64 *)p, v); }
+static inline bool atomicCas(volatile size_t *p, size_t o, size_t n) { return (size_t)InterlockedCompareExchange64((volatile LONG64 *)p, n, o) == o; }
+static inline void atomicStore(volatile size_t *p, size_t v) { InterlockedExchange64((volatile LONG64 *)p, v); }
+#else
+static inline size_t atomicAdd(volatile size_t *p, size_t v) { return InterlockedExchangeAdd((volatile LONG *)p, v) + v; }
+static inline size_t atomicOr(volatile size_t *p, size_t v) { return InterlockedOr((volatile LONG *)p, v); }
+static inline bool atomicCas(volatile size_t *p, size_t o, size_t n) { return (size_t)InterlockedCompareExchange((volatile LONG *)p, n, o) == o; }
+static inline void atomicStore(volatile size_t *p, size_t v) { InterlockedExchange((volatile LONG *)p, v); }
+#endif
+static inline void atomicRelease(volatile size_t *p, size_t v) { _ReadWriteBarrier(); *p = v; }
+static inline void atomicFence() { MemoryBarrier(); }
+#else
+// POSIX threads
+#include <sched.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define THREAD_PROC(name) void *name(void *param)
+#define THREAD_LOCAL __thread
+typedef pthread_key_t threadkey_t;
+#define THREAD_EXIT_PROC(name) void name(void *param)
+static inline void startThread(thread_t *t, void *(*proc)(void *), void *param) { pthread_create(t, NULL, proc, param); }
+static inline void joinThread(thread_t t) { pthread_join(t, NULL); }
+static inline void yieldThread() { sched_yield(); }
+static inline void initMutex(mutex_t *m) { pthread_mutex_init(m, NULL); }
+static inline void deleteMutex(mutex_t *m) { pthread_mutex_destroy(m); }
+static inline void lockMutex(mutex_t *m) { pthread_mutex_lock(m); }
+static inline void unlockMutex(mutex_t *m) { pthread_mutex_unlock(m); }
+static inline void initCond(cond_t *c) { pthread_cond_init(c, NULL); }
+static inline void deleteCond(cond_t *c) { pthread_cond_destroy(c); }
+static inline void waitCond(cond_t *c, mutex_t *m) { pthread_cond_wait(c, m); }
+static inline void notifyCond(cond_t *c) { pthread_cond_broadcast(c); }
+static inline void initThreadKey(threadkey_t *k, void (*proc)(void *)) { pthread_key_create(k, proc); }
+static inline void deleteThreadKey(threadkey_t k) { pthread_key_delete(k); }
+static inline void setThreadKey(threadkey_t k, void *v) { pthread_setspecific(k, v); }
+static inline size_t atomicAdd(volatile size_t *p, size_t v) { return __sync_add_and_fetch(p, v); }
+static inline size_t atomicOr(volatile size_t *p, size_t v) { return __sync_fetch_and_or(p, v); }
+static inline bool atomicCas(volatile size_t *p, size_t o, size_t n) { return __sync_bool_compare_and_swap(p, o, n); }
+static inline void atomicStore(volatile size_t *p, size_t v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+static inline void atomicRelease(volatile size_t *p, size_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline void atomicFence() { __sync_synchronize(); }
+#endif
+
+#endif //GC_MULTITHREADED || GC_MARK_THREADS
+
+
+namespace gc {
+
+
+//max heaps
+#define _MAX_HEAPS           256
+
+
+//default max blocks of the old generation of a heap
+#define _DEFAULT_MAX_BLOCKS  262144
+
+
+//default initial root pointers of the root stack of a thread
+#define _DEFAULT_ROOT_STACK  1024
+
+
+//max root pointers of the root stack of a thread; the slot of a root is
+//kept in the index of the pointer
+#define _MAX_ROOT_STACK      ((size_t)1 << 30)
+
+
+//index of a root pointer that has no slot; it was moved to another one
+#define _NO_ROOT_SLOT        (((size_t)1 << 31) - 1)
+
+
+//index of a root pointer on the stack, which is scanned for it
+#define _STACK_ROOT_SLOT     (_NO_ROOT_SLOT - 1)
+
+
+//max size of an object; the size of a block, header included, has 28 bits
+#define _MAX_OBJECT_SIZE     (((size_t)1 << 28) - 2 * sizeof(size_t))
+
+
+//bytes of the nursery per block of the young block table
+#define _YOUNG_BLOCK_BYTES   64
+
+
+//max slots of old objects that point to young objects
+#define _MAX_REMEMBERED      65536
+
+
+//bytes of the nursery given to a thread-local allocation buffer
+#define _TLAB_SIZE           32768
+
+
+//max young blocks given to a thread-local allocation buffer
+#define _TLAB_BLOCKS         512
+
+
+//min young blocks given to a thread-local allocation buffer
+#define _TLAB_MIN_BLOCKS     16
+
+
+//objects bigger than this are not allocated from thread-local buffers
+#define _TLAB_MAX_OBJECT     (_TLAB_SIZE / 8)
+
+
+//number of blocks processed between checks of the incremental marking clock
+#define _DRAIN_CHECK_INTERVAL 64
+
+
+//number of gray blocks the marking thread scans without holding the lock
+#define _MARKER_BATCH        256
+
+
+//number of pointers the marking thread collects without holding the lock
+#define _MARKER_TARGETS      4096
+
+
+//initial number of entries of the mark stack
+#define _GRAY_SIZE           4096
+
+
+//initial number of entries of the list of weak pointers to young objects
+#define _WEAK_SIZE           256
+
+
+//initial number of entries of the list of objects pinned by the stack
+#define _PINNED_SIZE         256
+
+
+//initial number of entries of the finalization queue
+#define _FINALIZE_SIZE       1024
+
+
+//number of objects finalized by an allocation
+#define _FINALIZE_BATCH      64
+
+
+//number of pointers between prefetching a target and processing it
+#define _PREFETCH_DISTANCE   4
+
+
+//max size classes of cells of the mark-sweep old generation
+#define _MAX_CLASSES         32
+
+
+//alignment of the old generation; it is the size of a huge page
+#define _MEMORY_ALIGN        (2 * 1024 * 1024)
+
+
+//max growth of the pacing of full collections, in times the configured one
+#define _MAX_GROWTH_FACTOR   16
+
+
+//bits in a word of a bitmap
+#define _WORD_BITS           (sizeof(size_t) * 8)
+
+
+//bytes of memory covered by a word of a start bitmap; it has a bit for
+//each word of memory, which is set if a block header is there
+#define _START_BYTES         (sizeof(size_t) * _WORD_BITS)
+
+
+//align an offset to a word of a start bitmap
+#define _START_ALIGN(N)      (((N) + _START_BYTES - 1) / _START_BYTES * _START_BYTES)
+
+
+//header bit that marks a block index as an index of the young block table
+#define _YOUNG_BIT           ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
+
+//header bit that marks a block index as an index of the large block table
+#define _LARGE_BIT           (_YOUNG_BIT >> 1)
+
+
+//bytes of a page of the large object space
+#define _LARGE_PAGE          4096
+
+
+//internal object for doing initialization and clean up
+struct __library {
+    //dynamic initialization
+    __library();
+
+    //clean up
+    ~__library();
+};
+
+
+//memory block descriptor; the pointers of its object are linked in a chain
+//whose first offset is ptrs, or, if the type of the object has a pointer
+//map, ptrs is the map
+struct _block {
+    Object *object;
+    Object *new_object;
+    size_t ptrs;
+    size_t size:28;
+    size_t adjust_phase:1;
+    size_t kept:1;
+    size_t finalize:1;
+    size_t weak:1;
+    size_t mapped:1;
+};
+
+
+//root stack of a thread: its root pointers are pushed and popped in the
+//order of their lifetimes, without holding the lock; the slots of roots
+//that are destroyed out of order are null until the roots above them are
+//popped; a thread is busy while it pushes or pops, so as that a collection
+//can wait for it; a thread with mutator scopes is stopped by collections
+//until it is safe
+struct _root_stack {
+    _basic_ptr **slots;
+    size_t top;
+    size_t size;
+#if GC_MULTITHREADED == 1
+    volatile size_t busy;
+    void *owner;
+    _heap *heap;
+    volatile size_t safe;
+    size_t mutators;
+#if GC_CONSERVATIVE == 1
+    char *stack_top;
+    char *stack_high;
+#endif
+#endif
+    _root_stack *next;
+};
+
+
+//states of the pages of the large object space; freed pages stay committed
+//until the next collection, so as that they are reused without faults
+enum _large_page_state {
+    _LARGE_FREE,
+    _LARGE_USED,
+    _LARGE_DIRTY
+};
+
+
+//run of free pages of the large object space
+struct _large_run {
+    size_t first;
+    size_t count;
+};
+
+
+//types of the contexts of the optional parts of the collector
+struct _tlab;
+struct _deque;
+struct _page;
+struct _region;
+
+
+//heap: the context of a collector; the tables are sized by the
+//configuration of the heap when it is created
+struct _heap {
+    //configuration
+    Heap *owner;
+    size_t id;
+    size_t serial;
+    size_t max_blocks;
+    size_t root_stack_size;
+    size_t max_young_blocks;
+    size_t min_memory_size;
+    size_t max_memory_size;
+    size_t large_object_size;
+    size_t large_space_size;
+    size_t max_large_pages;
+
+#if GC_MULTITHREADED == 1
+    //lock; it is recursive, because finalizers that run inside a collection
+    //free their memory
+#ifdef WIN32
+    CRITICAL_SECTION cr;
+    CONDITION_VARIABLE cr_cond;
+#else
+    pthread_mutex_t cr;
+    pthread_cond_t cr_cond;
+#endif
+#endif
+
+    //old generation context
+    size_t phase;
+    char *memory;
+    char *memory_end;
+    char *memory_space;
+    size_t memory_size;
+    size_t alloc_size;
+    size_t free_index;
+    _block *blocks;
+    size_t curr_block;
+
+    //root stacks of the threads; while a collection walks them, threads
+    //push and pop their roots with the lock
+    _root_stack *root_stacks;
+#if GC_MULTITHREADED == 1
+    volatile size_t roots_stopped;
+    threadkey_t roots_key;
+
+    //set while a collection stops the registered mutators; they wait for
+    //it on the lock at their safepoints
+    volatile size_t stop_requested;
+#endif
+
+    //state bitmaps of the block tables; the state is kept apart from the
+    //block descriptors, so as that parallel markers can set marks
+    //atomically and scans test the blocks of a word at once; locked blocks
+    //are roots, and deleted blocks were freed or are not allocated yet
+    size_t *marks;
+    size_t *young_marks;
+    size_t *locks;
+    size_t *young_locks;
+    size_t *deletes;
+    size_t *young_deletes;
+
+    //start bitmaps of the generations; an address inside an object is
+    //mapped to its block by the nearest header before it
+    size_t *starts;
+    size_t *young_starts;
+
+    //young generation context
+    char *nursery;
+    size_t nursery_size;
+    size_t young_size;
+    size_t young_index;
+    size_t young_limit;
+    _block *young;
+    size_t young_count;
+    size_t *young_kept;
+    size_t young_kept_count;
+    _basic_ptr **remembered;
+    size_t remembered_count;
+    int remembered_overflow;
+    int promotion_failed;
+
+    //large object space context; large blocks take runs of pages of a
+    //reserved address range, and they are marked but never moved; they are
+    //paced along with the old generation
+    char *large_space;
+    char *large_end;
+    size_t large_top;
+    unsigned char *large_pages;
+    _large_run *large_runs;
+    size_t large_run_count;
+    _block *large;
+    size_t large_count;
+    size_t *large_marks;
+    size_t *large_locks;
+    size_t *large_deletes;
+    size_t *large_first;
+    size_t large_size;
+
+    //marking context; the mark stack holds the gray blocks during marking
+    //and the blocks whose pointers are to be adjusted during compaction
+    _block **gray;
+    size_t gray_size;
+    size_t gray_count;
+    int gray_overflow;
+    int marking;
+
+    //pacing context; a full collection is due when the old and large
+    //objects grow past the trigger, which is set from the bytes that
+    //survived the last one; the growth doubles while full collections take
+    //more than their share of the time, and it halves back as they take less
+    size_t growth_percent;
+    size_t growth;
+    size_t min_trigger;
+    size_t max_pause_share;
+    size_t trigger;
+    size_t paced_at;
+
+    //finalization context; dead objects that have finalizers are locked by
+    //the collection that finds them and queued; their finalizers run after
+    //its pause, and their memory is reclaimed by the next one
+    Object **finalize_queue;
+    size_t finalize_count;
+    size_t finalize_size;
+    int finalizing;
+
+    //weak pointers context; weak pointers are not traced, and the ones
+    //whose objects die are cleared; a minor collection lists the weak
+    //pointers to young objects it finds, and it forwards or clears them
+    //once the survivors are promoted; a full collection walks the weak
+    //pointers of the blocks that have any, once a weak member was added
+    _basic_ptr **weak_slots;
+    size_t weak_count;
+    size_t weak_size;
+    int weak_members;
+
+#if GC_CONSERVATIVE == 1
+    //conservative roots context; the objects that words of the stack may
+    //point into are locked during the pauses, and listed, so as that only
+    //they are unlocked afterwards
+    Object **pinned;
+    size_t pinned_count;
+    size_t pinned_size;
+#endif
+
+    //statistics; pauses nest, and only the outermost one is counted, and
+    //reported to the callback if it did a collection
+    Stats stats;
+    size_t pause_depth;
+    int stats_pending;
+    CollectionCallback callback;
+    void *callback_data;
+
+#if GC_MULTITHREADED == 1
+    //thread-local allocation context; a buffer is valid while its epoch is
+    //the current one, and collections start a new epoch
+    _tlab *tlabs;
+    volatile size_t tlab_epoch;
+    threadkey_t tlab_key;
+#endif
+
+#if GC_CONCURRENT == 1
+    //concurrent marking context
+    _block *marker_batch[_MARKER_BATCH];
+    size_t marker_batch_count;
+    size_t marker_trigger;
+    int marker_exit;
+    thread_t marker_thread;
+    mutex_t marker_mutex;
+#endif
+
+#if GC_MARK_THREADS > 1
+    //parallel marking context
+    _deque *deques;
+    volatile size_t markers_idle;
+
+    //worker threads; they run the parallel phases of a collection
+    void (*workers_job)(size_t id);
+    size_t workers_round;
+    size_t workers_done;
+    volatile size_t workers_started;
+    int workers_exit;
+    thread_t workers[GC_MARK_THREADS];
+    mutex_t workers_mutex;
+    cond_t workers_cond;
+#endif
+
+#if GC_MARK_SWEEP == 1
+    //mark-sweep context; pages of each size class that have free cells
+    //are kept in a list
+    _page *pages;
+    size_t max_pages;
+    size_t free_page_count;
+    size_t class_pages[_MAX_CLASSES];
+#elif GC_MARK_THREADS > 1
+    //parallel compaction context
+    _region *regions;
+    size_t region_count;
+    volatile size_t regions_next;
+#endif
+};
+
+
+//the default heap, and the heaps by id
+static _heap _default_heap;
+static _heap *_heaps[_MAX_HEAPS];
+static size_t _heap_count = 1;
+static size_t _heap_serial = 0;
+
+
+//the heap the calling thread works on; a thread works on the heap it is
+//bound to, and on the heap of the pointer or object it operates on
+#if GC_MULTITHREADED == 1 || GC_MARK_THREADS > 1
+static THREAD_LOCAL _heap *_h = &_default_heap;
+#else
+static _heap *_h = &_default_heap;
+#endif
+
+
+//the object the calling thread is constructing, if its type has a pointer
+//map, and the id of its heap
+#if GC_MULTITHREADED == 1 || GC_MARK_THREADS > 1
+static THREAD_LOCAL char *_mapped_begin = 0;
+static THREAD_LOCAL char *_mapped_end = 0;
+static THREAD_LOCAL size_t _mapped_heap = 0;
+#else
+static char *_mapped_begin = 0;
+static char *_mapped_end = 0;
+static size_t _mapped_heap = 0;
+#endif
+
+
+#if GC_CONSERVATIVE == 1
+//bounds of the stack of the calling thread, which is scanned for roots
+#if GC_MULTITHREADED == 1
+static THREAD_LOCAL char *_stack_low = 0;
+static THREAD_LOCAL char *_stack_high = 0;
+#else
+static char *_stack_low = 0;
+static char *_stack_high = 0;
+#endif
+
+
+//find the bounds of the stack of the calling thread, the first time
+static void _find_stack()
+{
+    if (_stack_high) return;
+#ifdef WIN32
+    ULONG_PTR low, high;
+    GetCurrentThreadStackLimits(&low, &high);
+    _stack_low = (char *)low;
+    _stack_high = (char *)high;
+#elif defined(__APPLE__)
+    pthread_t self = pthread_self();
+    _stack_high = (char *)pthread_get_stackaddr_np(self);
+    _stack_low = _stack_high - pthread_get_stacksize_np(self);
+#else
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+    if (pthread_getattr_np(pthread_self(), &attr) || pthread_attr_getstack(&attr, &addr, &size)) {
+        fprintf(stderr, "gc: can not find the stack\n");
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+    _stack_low = (char *)addr;
+    _stack_high = _stack_low + size;
+#endif
+}
+
+
+//checks if a pointer is on the stack of the calling thread
+static inline bool _on_stack(const void *p)
+{
+    _find_stack();
+    return p >= (void *)_stack_low && p < (void *)_stack_high;
+}
+
+
+#if GC_MULTITHREADED == 1
+//record the top of the stack of a registered mutator that becomes safe; the
+//frames of its callers are all above it, and the collections scan them
+static NOINLINE void _save_stack(_root_stack *stack)
+{
+    stack->stack_top = FRAME_ADDRESS();
+}
+#endif
+#endif
+
+
+#if GC_MULTITHREADED == 1
+//thread-local allocation buffer: a range of the nursery and of the young
+//block table that its thread allocates from without holding the lock; the
+//thread is busy while it allocates, so as that a collection can wait for it
+struct _tlab {
+    char *top;
+    char *end;
+    size_t index;
+    size_t end_index;
+    size_t blocks;
+    size_t epoch;
+    volatile size_t busy;
+    void *owner;
+    _heap *heap;
+    _tlab *next;
+};
+
+
+//the buffer the calling thread allocated from last, and the serial number
+//of its heap; a buffer of another heap, or of a deleted one, is not used
+static THREAD_LOCAL _tlab *_thread_tlab = 0;
+static THREAD_LOCAL size_t _thread_tlab_serial = 0;
+
+
+//the root stack the calling thread used last, and the serial number of its
+//heap; a stack of another heap, or of a deleted one, is not used
+static THREAD_LOCAL _root_stack *_thread_roots = 0;
+static THREAD_LOCAL size_t _thread_roots_serial = 0;
+
+
+//the root stack of the mutator scopes of the calling thread, and the serial
+//number of their heap
+static THREAD_LOCAL _root_stack *_thread_mutator = 0;
+static THREAD_LOCAL size_t _thread_mutator_serial = 0;
+#endif
+
+
+//locking of the heap of the calling thread
 #if GC_MULTITHREADED == 1
 
-//win32 locking
+//win32 locking; critical sections are recursive
 #ifdef WIN32
-static CRITICAL_SECTION cr;
-static void initLock() { InitializeCriticalSection(&cr); }
-static void deleteLock() { DeleteCriticalSection(&cr); }
-static void lock() { EnterCriticalSection(&cr); }
-static void unlock() { LeaveCriticalSection(&cr); }
+static void initLock() { InitializeCriticalSection(&_h->cr); InitializeConditionVariable(&_h->cr_cond); }
+static void deleteLock() { DeleteCriticalSection(&_h->cr); }
+static inline void lockHeap() { EnterCriticalSection(&_h->cr); }
+static void unlock() { LeaveCriticalSection(&_h->cr); }
+static inline void waitLock() { SleepConditionVariableCS(&_h->cr_cond, &_h->cr, INFINITE); }
+static inline void notifyLock() { WakeAllConditionVariable(&_h->cr_cond); }
 #else
 // POSIX platforms
-static pthread_mutex_t cr;
-static int cr_alreadyLocked = 0;
+static void initLock() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_h->cr, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&_h->cr_cond, NULL);
+}
+
+static void deleteLock() {
+    pthread_cond_destroy(&_h->cr_cond);
+    pthread_mutex_destroy(&_h->cr);
+}
+
+static inline void lockHeap() { pthread_mutex_lock(&_h->cr); }
+static void unlock() { pthread_mutex_unlock(&_h->cr); }
+static inline void waitLock() { pthread_cond_wait(&_h->cr_cond, &_h->cr); }
+static inline void notifyLock() { pthread_cond_broadcast(&_h->cr_cond); }
+#endif
+
+
+//lock the heap; a registered mutator is safe while it waits for the lock,
+//so as that a collection that holds it does not wait for the thread
+static void lock()
+{
+    _root_stack *mutator = _thread_mutator_serial == _h->serial ? _thread_mutator : 0;
+    if (!mutator) {
+        lockHeap();
+        return;
+    }
+    size_t safe = mutator->safe;
+#if GC_CONSERVATIVE == 1
+    //the stack is scanned from here while the thread waits, and the
+    //registers are spilled to it
+    SPILL_REGISTERS();
+    if (!safe) _save_stack(mutator);
+#endif
+    atomicStore(&mutator->safe, 1);
+    lockHeap();
+    mutator->safe = safe;
+}
+
+//else single-threaded
+#else // WIN32
+//empty functions that will be removed by the compiler
+static void initLock() {}
+static void deleteLock() {}
+static void lock() {}
+static void unlock() {}
+#endif //GC_MULTITHREADED
+
+
+//make a heap the heap of the calling thread and lock it; returns the
+//previous heap of the thread
+static inline _heap *_enter(_heap *heap)
+{
+    _heap *prev = _h;
+    _h = heap;
+    lock();
+    return prev;
+}
+
+
+//unlock the heap of the calling thread and give it back its previous heap
+static inline void _leave(_heap *prev)
+{
+    unlock();
+    _h = prev;
+}
+
+
+//checks if the given address is inside the old generation
+static inline bool _is_old(const void *p)
+{
+    return p >= (void *)_h->memory && p < (void *)_h->memory_end;
+}
+
+
+//checks if the given address is inside the young generation
+static inline bool _is_young(const void *p)
+{
+    return p >= (void *)_h->nursery && p < (void *)(_h->nursery + _h->nursery_size);
+}
+
+
+//checks if the given address is inside the large object space
+static inline bool _is_large(const void *p)
+{
+    return p >= (void *)_h->large_space && p < (void *)_h->large_end;
+}
+
+
+//checks if the given address is inside the memory of a heap
+static inline bool _in_heap(_heap *heap, const void *p)
+{
+    return (p >= (void *)heap->memory && p < (void *)heap->memory_end) ||
+           (p >= (void *)heap->nursery && p < (void *)(heap->nursery + heap->nursery_size)) ||
+           (p >= (void *)heap->large_space && p < (void *)heap->large_end);
+}
+
+
+//get the heap whose memory holds the given address; addresses outside of
+//all heaps belong to the heap of the calling thread
+static _heap *_heap_of(const void *p)
+{
+    if (_in_heap(_h, p)) return _h;
+    for(size_t i = 0; i < _heap_count; ++i) {
+        if (_heaps[i] && _heaps[i] != _h && _in_heap(_heaps[i], p)) return _heaps[i];
+    }
+    return _h;
+}
+
+
+//get the block of an object
+static inline _block *_get_block(void *p)
+{
+    size_t index = *((size_t *)p - 1);
+    if (index & _YOUNG_BIT) return &_h->young[index & ~_YOUNG_BIT];
+    if (index & _LARGE_BIT) return &_h->large[index & ~_LARGE_BIT];
+    return &_h->blocks[index];
+}
+
+
+//get the index of a block in its table and the state bitmaps of the table
+static inline size_t _block_maps(_block *block, size_t **marks, size_t **locks, size_t **deletes)
+{
+    if (block >= _h->young && block < _h->young + _h->max_young_blocks) {
+        *marks = _h->young_marks;
+        *locks = _h->young_locks;
+        *deletes = _h->young_deletes;
+        return block - _h->young;
+    }
+    if (block >= _h->large && block < _h->large + _h->max_large_pages) {
+        *marks = _h->large_marks;
+        *locks = _h->large_locks;
+        *deletes = _h->large_deletes;
+        return block - _h->large;
+    }
+    *marks = _h->marks;
+    *locks = _h->locks;
+    *deletes = _h->deletes;
+    return block - _h->blocks;
+}
+
+
+//get the block of an object, its index in its table, and the mark and lock
+//bitmaps of the table; the header of the object tells the table
+static inline _block *_object_state(void *p, size_t *index, size_t **marks, size_t **locks)
+{
+    size_t header = *((size_t *)p - 1);
+    if (header & _YOUNG_BIT) {
+        *index = header & ~_YOUNG_BIT;
+        *marks = _h->young_marks;
+        *locks = _h->young_locks;
+        return &_h->young[*index];
+    }
+    if (header & _LARGE_BIT) {
+        *index = header & ~_LARGE_BIT;
+        *marks = _h->large_marks;
+        *locks = _h->large_locks;
+        return &_h->large[*index];
+    }
+    *index = header;
+    *marks = _h->marks;
+    *locks = _h->locks;
+    return &_h->blocks[header];
+}
+
+
+//get the mark bit of a block and the bitmap word it is in
+static inline size_t _mark_bit(_block *block, size_t **word)
+{
+    size_t *marks, *locks, *deletes;
+    size_t index = _block_maps(block, &marks, &locks, &deletes);
+    *word = &marks[index / _WORD_BITS];
+    return (size_t)1 << (index % _WORD_BITS);
+}
+
+
+//checks a bit of a bitmap
+static inline bool _test_bit(const size_t *map, size_t index)
+{
+    return (map[index / _WORD_BITS] >> (index % _WORD_BITS)) & 1;
+}
+
+
+//set or clear a bit of a state bitmap; the state is changed with the lock
+//only, so as that threads that allocate from their buffers do not set it
+static inline void _put_bit(size_t *map, size_t index, bool value)
+{
+    size_t bit = (size_t)1 << (index % _WORD_BITS);
+    if (value) map[index / _WORD_BITS] |= bit;
+    else map[index / _WORD_BITS] &= ~bit;
+}
+
+
+//the word of a bitmap scan at the given bit; the bits of the blocks past
+//the count of the table are cleared
+static inline size_t _scan_word(size_t word, size_t index, size_t count)
+{
+    return count - index < _WORD_BITS ? word & (((size_t)1 << (count - index)) - 1) : word;
+}
+
+
+//checks if a block is locked
+static inline bool _is_locked(_block *block)
+{
+    size_t *marks, *locks, *deletes;
+    return _test_bit(locks, _block_maps(block, &marks, &locks, &deletes));
+}
+
+
+//lock or unlock a block
+static inline void _set_locked(_block *block, bool value)
+{
+    size_t *marks, *locks, *deletes;
+    size_t index = _block_maps(block, &marks, &locks, &deletes);
+    _put_bit(locks, index, value);
+}
+
+
+//set a block as deleted or not
+static inline void _set_deleted(_block *block, bool value)
+{
+    size_t *marks, *locks, *deletes;
+    size_t index = _block_maps(block, &marks, &locks, &deletes);
+    _put_bit(deletes, index, value);
+}
+
+
+//set the state of a new block: it is locked and not deleted
+static inline void _set_new_state(size_t *locks, size_t *deletes, size_t index)
+{
+    _put_bit(locks, index, 1);
+    _put_bit(deletes, index, 0);
+}
+
+
+//checks if a block survives a collection, given the state bitmaps of its
+//table: a locked block survives unless it is deleted, else if it is marked
+static inline bool _survives(const size_t *marks, const size_t *locks, const size_t *deletes, size_t index)
+{
+    return _test_bit(locks, index) ? !_test_bit(deletes, index) : _test_bit(marks, index);
+}
+
+
+//writer of the state of the surviving blocks of a table as the table is
+//compacted; the state moves to lower indices, and it is stored a word at a
+//time; marks are not moved, because they are cleared before they are used
+struct _state_writer {
+    size_t *locks;
+    size_t *deletes;
+    size_t index;
+    size_t lock_word;
+    size_t delete_word;
+};
+
+
+//start writing the state of a table at the given index
+static inline void _begin_state(_state_writer *w, size_t *locks, size_t *deletes, size_t index)
+{
+    size_t mask = ((size_t)1 << (index % _WORD_BITS)) - 1;
+    w->locks = locks;
+    w->deletes = deletes;
+    w->index = index;
+    w->lock_word = locks[index / _WORD_BITS] & mask;
+    w->delete_word = deletes[index / _WORD_BITS] & mask;
+}
+
+
+//append the state of a block; the bits are 0 or 1
+static inline void _write_state(_state_writer *w, size_t locked, size_t deleted)
+{
+    size_t bit = w->index % _WORD_BITS;
+    w->lock_word |= locked << bit;
+    w->delete_word |= deleted << bit;
+    if (++w->index % _WORD_BITS == 0) {
+        w->locks[w->index / _WORD_BITS - 1] = w->lock_word;
+        w->deletes[w->index / _WORD_BITS - 1] = w->delete_word;
+        w->lock_word = w->delete_word = 0;
+    }
+}
+
+
+//store the last word of the state
+static inline void _end_state(_state_writer *w)
+{
+    size_t bit = w->index % _WORD_BITS, i = w->index / _WORD_BITS;
+    if (!bit) return;
+    size_t mask = ((size_t)1 << bit) - 1;
+    w->locks[i] = (w->locks[i] & ~mask) | w->lock_word;
+    w->deletes[i] = (w->deletes[i] & ~mask) | w->delete_word;
+}
+
+
+//checks if a block is marked
+static inline bool _is_marked(_block *block)
+{
+    size_t *word;
+    size_t bit = _mark_bit(block, &word);
+    return (*word & bit) != 0;
+}
+
+
+//mark a block
+static inline void _set_mark(_block *block)
+{
+    size_t *word;
+    size_t bit = _mark_bit(block, &word);
+    *word |= bit;
+}
+
+
+//clear the marks of the first blocks of a bitmap
+static inline void _clear_marks(size_t *marks, size_t count)
+{
+    memset(marks, 0, (count + _WORD_BITS - 1) / _WORD_BITS * sizeof(size_t));
+}
+
+
+//record the header of a block in a start bitmap, given its offset
+static inline void _set_start(size_t *starts, size_t offset)
+{
+    offset /= sizeof(size_t);
+    starts[offset / _WORD_BITS] |= (size_t)1 << (offset % _WORD_BITS);
+}
+
+
+//forget the header of a block in a start bitmap, given its offset
+static inline void _clear_start(size_t *starts, size_t offset)
+{
+    offset /= sizeof(size_t);
+    starts[offset / _WORD_BITS] &= ~((size_t)1 << (offset % _WORD_BITS));
+}
+
+
+//find the offset of the nearest header at or before an offset; the search
+//takes a word of the bitmap per _START_BYTES of the object, so it is
+//short, because big objects are in the large object space
+static inline size_t _find_start(const size_t *starts, size_t offset)
+{
+    offset /= sizeof(size_t);
+    size_t i = offset / _WORD_BITS, bit = offset % _WORD_BITS;
+    size_t word = starts[i] & (bit == _WORD_BITS - 1 ? ~(size_t)0 : ((size_t)2 << bit) - 1);
+    while (!word) word = starts[--i];
+    return (i * _WORD_BITS + highestBit(word)) * sizeof(size_t);
+}
+
+
+//get the block that a slot of the gc memory is in
+static _block *_find_block(void *slot)
+{
+    char *p = (char *)slot;
+    char *header;
+    if (_is_young(p)) {
+        header = _h->nursery + _find_start(_h->young_starts, p - _h->nursery);
+    }
+    else if (_is_large(p)) {
+        header = _h->large_space + _h->large_first[(p - _h->large_space) / _LARGE_PAGE] * _LARGE_PAGE;
+    }
+    else {
+        header = _h->memory + _find_start(_h->starts, p - _h->memory);
+    }
+    return _get_block((size_t *)header + 1);
+}
+
+
+//map of arrays of pointers; their pointers are the items that follow the
+//header, up to the length of the array
+static const size_t _pointer_items_map[] = {0};
+
+
+//map of leaves and of arrays of other items; they are not scanned; a
+//leaf that is finalized has its finalizer in the last word of its object
+static const size_t _leaf_map[] = {0};
+
+
+//cursor over the pointers of a block: the offset of the next pointer is
+//in the pointer before it, or in the next entry of the map, or, for an
+//array of pointers, after it up to the end of the items
+struct _ptr_cursor {
+    char *object;
+    size_t bp;
+    const size_t *map;
+    size_t end;
+};
+
+
+//start a cursor at the first pointer of a block
+static inline void _first_ptr(_ptr_cursor *c, const _block *block)
+{
+    c->object = (char *)block->object;
+    c->map = block->mapped ? (const size_t *)block->ptrs : 0;
+    c->bp = c->map ? *c->map : block->ptrs;
+    c->end = 0;
+    if (c->map == _pointer_items_map) {
+        size_t length = ((_array *)c->object)->m_length;
+        c->bp = length ? sizeof(_array) : 0;
+        c->end = sizeof(_array) + length * sizeof(_basic_ptr);
+    }
+}
+
+
+//get the pointer of a cursor and advance it; returns null at the end
+static inline _basic_ptr *_next_ptr(_ptr_cursor *c)
+{
+    if (!c->bp) return 0;
+    _basic_ptr *p = (_basic_ptr *)(c->object + c->bp);
+    if (c->end) {
+        c->bp += sizeof(_basic_ptr);
+        if (c->bp == c->end) c->bp = 0;
+    }
+    else {
+        c->bp = c->map ? *++c->map : p->index;
+    }
+    return p;
+}
+
+
+//checks if the pointers of a block are scanned; the blocks of leaves are
+//black as soon as they are marked
+static inline bool _traced(const _block *block)
+{
+    return !block->mapped || (const size_t *)block->ptrs != _leaf_map;
+}
+
+
+//get the finalizer of a leaf, which is the function in the last word of its
+//object; the other objects are finalized by their destructor, and have none
+static inline _leaf_finalizer _finalizer_of(Object *obj)
+{
+    _block *block = _get_block(obj);
+    if (_traced(block)) return 0;
+    return *(_leaf_finalizer *)((char *)obj + block->size - sizeof(_leaf_finalizer));
+}
+
+
+//finalize a dead object and free it, given its finalizer if it is a leaf;
+//it does not need the lock
+static void _finalize(Object *obj, _leaf_finalizer finalizer)
+{
+    if (!finalizer) {
+        delete obj;
+        return;
+    }
+    finalizer(obj);
+    Object::operator delete(obj);
+}
+
+
+//finalize a dead object and free it
+static inline void _finalize(Object *obj)
+{
+    _finalize(obj, _finalizer_of(obj));
+}
+
+
+//push a block to the mark stack; if the stack can not grow, the overflow is
+//recorded and the block is found again by a scan of the block tables
+static void _push_gray(_block *block)
+{
+    if (_h->gray_count == _h->gray_size) {
+        size_t size = _h->gray_size ? _h->gray_size * 2 : _GRAY_SIZE;
+        _block **gray = (_block **)realloc(_h->gray, size * sizeof(_block *));
+        if (!gray) {
+            _h->gray_overflow = 1;
+            return;
+        }
+        _h->gray = gray;
+        _h->gray_size = size;
+    }
+    _h->gray[_h->gray_count++] = block;
+}
+
+
+//pipeline of pointers that are processed a few pointers after they are
+//seen: the header of the target is prefetched when a pointer enters, its
+//block descriptor and mark word when the pointer is halfway, and the
+//target is processed when the pointer leaves
+struct _prefetch_fifo {
+    _basic_ptr *ptrs[_PREFETCH_DISTANCE * 2];
+    size_t head;
+    size_t count;
+};
+
+
+//take the oldest pointer out of the pipeline; returns null if it is empty
+static inline _basic_ptr *_fifo_pop(_prefetch_fifo *fifo)
+{
+    if (!fifo->count) return 0;
+    _basic_ptr *p = fifo->ptrs[fifo->head];
+    fifo->head = (fifo->head + 1) % (_PREFETCH_DISTANCE * 2);
+    --fifo->count;
+    return p;
+}
+
+
+//put a pointer in the pipeline; returns the pointer that leaves it, if any
+static inline _basic_ptr *_fifo_push(_prefetch_fifo *fifo, _basic_ptr *p)
+{
+    //null pointers need no processing
+    if (!p->object) return 0;
+
+    //the header precedes the object, so its line holds the start of the body
+    prefetch((size_t *)p->object - 1);
+    fifo->ptrs[(fifo->head + fifo->count++) % (_PREFETCH_DISTANCE * 2)] = p;
+
+    //the header of the pointer that is halfway has arrived by now
+    if (fifo->count > _PREFETCH_DISTANCE) {
+        _basic_ptr *half = fifo->ptrs[(fifo->head + fifo->count - 1 - _PREFETCH_DISTANCE) % (_PREFETCH_DISTANCE * 2)];
+        size_t index, *marks, *locks;
+        _block *block = _object_state(half->object, &index, &marks, &locks);
+        prefetch(block);
+        prefetch(&marks[index / _WORD_BITS]);
+        prefetch(&locks[index / _WORD_BITS]);
+    }
+
+    //the pipeline is not full yet
+    if (fifo->count < _PREFETCH_DISTANCE * 2) return 0;
+
+    return _fifo_pop(fifo);
+}
+
+
+//record a slot of the old generation that points to the young generation
+static void _remember(_basic_ptr *p, Object *obj)
+{
+    //only old-to-young pointers are interesting; large blocks are old
+    if ((!_is_old(p) && !_is_large(p)) || !_is_young(obj)) return;
+
+    //ignore consecutive stores to the same slot
+    if (_h->remembered_count && _h->remembered[_h->remembered_count - 1] == p) return;
+
+    //if there is no more space, the next minor collection scans the old
+    //generation
+    if (_h->remembered_count == _MAX_REMEMBERED) {
+        _h->remembered_overflow = 1;
+        return;
+    }
+
+    _h->remembered[_h->remembered_count++] = p;
+}
+
+
+//mark an object; the object becomes gray until its pointers are processed
+//by _drain
+static void _shade(Object *obj)
+{
+    //pointer is null
+    if (!obj) return;
+
+    //young objects may move while an incremental marking is in progress;
+    //they are marked when the marking finishes
+    if (_h->marking && _is_young(obj)) return;
+
+    //get block
+    size_t index, *marks, *locks;
+    _block *block = _object_state(obj, &index, &marks, &locks);
+
+    //do nothing for locked blocks or for already marked blocks
+    if (_test_bit(locks, index) || _test_bit(marks, index)) return;
+
+    //mark object
+    _put_bit(marks, index, 1);
+    if (_traced(block)) _push_gray(block);
+}
+
+
+//mark object reachable from pointer; weak pointers are not traced
+static inline void _mark(_basic_ptr *p)
+{
+    if (!p->weak) _shade(p->object);
+}
+
+
+//mark the blocks reachable from the pointers of a block
+static void _mark_members(_block *block)
+{
+    _ptr_cursor c;
+    _first_ptr(&c, block);
+    while (_basic_ptr *ptr = _next_ptr(&c)) _mark(ptr);
+}
+
+
+//store a pointer; while a marking is in progress, the overwritten target
+//is shaded, so as that all objects reachable when the marking started are
+//marked (snapshot at the beginning); old-to-young pointers are remembered
+static void _write_barrier(_basic_ptr *p, Object *obj)
+{
+    if (_h->marking) _mark(p);
+    p->object = obj;
+    _remember(p, obj);
+}
+
+
+//mark the blocks reachable from the root set and from locked blocks
+static void _mark_roots()
+{
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        for(size_t i = 0; i < stack->top; ++i) {
+            if (stack->slots[i]) _mark(stack->slots[i]);
+        }
+    }
+
+    //locked blocks are marked, so as that they stay marked if they are
+    //unlocked while an incremental marking is in progress; the bitmaps are
+    //scanned a word at a time
+    size_t i, w, bits;
+    for(i = 0, w = 0; i < _h->curr_block; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->locks[w] & ~_h->deletes[w] & ~_h->marks[w], i, _h->curr_block);
+        for(; bits; bits &= bits - 1) {
+            _block *block = &_h->blocks[i + lowestBit(bits)];
+            _set_mark(block);
+            _push_gray(block);
+        }
+    }
+    for(i = 0, w = 0; i < _h->large_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->large_locks[w] & ~_h->large_deletes[w] & ~_h->large_marks[w], i, _h->large_count);
+        for(; bits; bits &= bits - 1) {
+            _block *block = &_h->large[i + lowestBit(bits)];
+            _set_mark(block);
+            _push_gray(block);
+        }
+    }
+    for(i = 0, w = 0; i < _h->young_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->young_locks[w] & ~_h->young_deletes[w], i, _h->young_count);
+        for(; bits; bits &= bits - 1) _mark_members(&_h->young[i + lowestBit(bits)]);
+    }
+}
+
+
+//current time in microseconds
+static size_t _now()
+{
+#ifdef WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (size_t)(counter.QuadPart * 1000000 / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (size_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+
+#if GC_CONSERVATIVE == 1
+//find the offset of the nearest header at or before an offset, if there is
+//one; unlike _find_start, the offset may be anywhere
+static inline bool _find_any_start(const size_t *starts, size_t offset, size_t *start)
+{
+    offset /= sizeof(size_t);
+    size_t i = offset / _WORD_BITS, bit = offset % _WORD_BITS;
+    size_t word = starts[i] & (bit == _WORD_BITS - 1 ? ~(size_t)0 : ((size_t)2 << bit) - 1);
+    while (!word && i) word = starts[--i];
+    if (!word) return false;
+    *start = (i * _WORD_BITS + highestBit(word)) * sizeof(size_t);
+    return true;
+}
+
+
+//get the block of the live object that an address points into; returns
+//null if it points into none
+static _block *_object_at(char *p)
+{
+    //find the nearest header
+    char *header;
+    size_t start;
+    if (_is_young(p)) {
+        if (!_find_any_start(_h->young_starts, p - _h->nursery, &start)) return 0;
+        header = _h->nursery + start;
+    }
+    else if (_is_large(p)) {
+        size_t page = (p - _h->large_space) / _LARGE_PAGE;
+        if (page >= _h->large_top || _h->large_pages[page] != _LARGE_USED) return 0;
+        header = _h->large_space + _h->large_first[page] * _LARGE_PAGE;
+    }
+    else if (p >= _h->memory && p < _h->memory + _h->memory_size) {
+        if (!_find_any_start(_h->starts, p - _h->memory, &start)) return 0;
+        header = _h->memory + start;
+    }
+    else {
+        return 0;
+    }
+
+    //the header may be the one of a dead block, so its block must point
+    //back to it, and be alive
+    size_t index = *(size_t *)header;
+    _block *block;
+    if (index & _YOUNG_BIT) {
+        if ((index & ~_YOUNG_BIT) >= _h->young_count) return 0;
+        block = &_h->young[index & ~_YOUNG_BIT];
+    }
+    else if (index & _LARGE_BIT) {
+        if ((index & ~_LARGE_BIT) >= _h->large_count) return 0;
+        block = &_h->large[index & ~_LARGE_BIT];
+    }
+    else {
+        if (index >= _h->curr_block) return 0;
+        block = &_h->blocks[index];
+    }
+    if ((char *)block->object != header + sizeof(size_t) || p < (char *)block->object || p >= (char *)block->object + block->size) {
+        return 0;
+    }
+    size_t *marks, *locks, *deletes;
+    index = _block_maps(block, &marks, &locks, &deletes);
+    return _test_bit(deletes, index) ? 0 : block;
+}
+
+
+//pin the object that an address points into, if any: it is locked, so as
+//that it is a root and it does not move; it is listed, so as that it is
+//unlocked when the roots resume
+static void _pin(char *p)
+{
+    _block *block = _object_at(p);
+    if (!block) return;
+    size_t *marks, *locks, *deletes;
+    size_t index = _block_maps(block, &marks, &locks, &deletes);
+    if (_test_bit(locks, index)) return;
+    if (_h->pinned_count == _h->pinned_size) {
+        size_t size = _h->pinned_size ? _h->pinned_size * 2 : _PINNED_SIZE;
+        Object **pinned = (Object **)realloc(_h->pinned, size * sizeof(Object *));
+        if (!pinned) {
+            fprintf(stderr, "gc: out of pinned object memory\n");
+            exit(-1);
+        }
+        _h->pinned = pinned;
+        _h->pinned_size = size;
+    }
+    _put_bit(locks, index, 1);
+    _h->pinned[_h->pinned_count++] = block->object;
+}
+
+
+//pin the objects that the words of a range of a stack point into
+static NO_SANITIZE_ADDRESS void _scan_range(char *low, char *high)
+{
+    for(char **p = (char **)low; (char *)p < high; ++p) _pin(*p);
+}
+
+
+//pin the objects that the words of the stack point into, from the frame of
+//this function up; the frames of its callers are all above it
+static NOINLINE void _scan_stack()
+{
+    _scan_range(FRAME_ADDRESS(), _stack_high);
+}
+
+
+//checks if the stack of the thread of a root stack is scanned: the one of
+//the calling thread is, and the ones of the registered mutators, which the
+//pause stopped
+static inline bool _scanned(const _root_stack *stack)
+{
+#if GC_MULTITHREADED == 1
+    return stack->mutators || stack->owner == &_thread_roots;
+#else
+    return true;
+#endif
+}
+
+
+//complement the objects of the weak roots of the threads whose stacks are
+//scanned, so as that the scan does not take them for pointers; a second
+//call restores them
+static void _flip_weak_roots()
+{
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        if (!_scanned(stack)) continue;
+        for(size_t i = 0; i < stack->top; ++i) {
+            _basic_ptr *p = stack->slots[i];
+            if (p && p->weak && p->object) p->object = (Object *)~(size_t)p->object;
+        }
+    }
+}
+
+
+//pin the objects that the stack and the registers point into, and the
+//stacks of the registered mutators, from the tops they saved as they
+//stopped; weak roots do not keep their objects
+static void _pin_stack()
+{
+    SPILL_REGISTERS();
+    _find_stack();
+    _flip_weak_roots();
+    _scan_stack();
+#if GC_MULTITHREADED == 1
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        if (stack->mutators && stack->owner != &_thread_roots) _scan_range(stack->stack_top, stack->stack_high);
+    }
+#endif
+    _flip_weak_roots();
+}
+
+
+//unlock the objects that the stack pinned
+static void _unpin_stack()
+{
+    while (_h->pinned_count) _set_locked(_get_block(_h->pinned[--_h->pinned_count]), 0);
+}
+#endif
+
+
+//stop the registered mutators at their safepoints; the threads that are
+//safe already are not waited for, and the calling thread goes on
+static void _stop_mutators()
+{
+#if GC_MULTITHREADED == 1
+    atomicStore(&_h->stop_requested, 1);
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        if (!stack->mutators || stack->owner == &_thread_roots) continue;
+        while (!stack->safe) yieldThread();
+    }
+#endif
+}
+
+
+//let the registered mutators go on from their safepoints when the lock is
+//released
+static void _resume_mutators()
+{
+#if GC_MULTITHREADED == 1
+    atomicRelease(&_h->stop_requested, 0);
+#endif
+}
+
+
+//stop the registered mutators at a safepoint; they wait on the lock while
+//a collection stops them
+static inline void _safepoint(_heap *heap)
+{
+#if GC_MULTITHREADED == 1
+    if (heap->stop_requested) {
+        _heap *prev = _enter(heap);
+        _leave(prev);
+    }
+#endif
+}
+
+
+//begin a pause of the threads for a collection; returns its start time; the
+//outermost one stops the registered mutators, and pins the objects that the
+//stacks point into, if the roots are found by scanning them
+static inline size_t _begin_pause()
+{
+    if (!_h->pause_depth) _stop_mutators();
+#if GC_CONSERVATIVE == 1
+    if (!_h->pause_depth) _pin_stack();
+#endif
+    ++_h->pause_depth;
+    return _now();
+}
+
+
+//end a pause; the outermost one unpins the objects that the stack pinned,
+//it lets the mutators go on, it is counted in the histogram, and the last
+//collection it did is reported
+static void _end_pause(size_t start)
+{
+    if (--_h->pause_depth) return;
+#if GC_CONSERVATIVE == 1
+    _unpin_stack();
+#endif
+    _resume_mutators();
+    size_t micros = _now() - start;
+    Stats *stats = &_h->stats;
+    ++stats->pauses;
+    stats->pauseMicros += micros;
+    if (micros > stats->maxPauseMicros) stats->maxPauseMicros = micros;
+    size_t bucket = micros ? highestBit(micros) + 1 : 0;
+    ++stats->pauseHistogram[bucket < Stats::PAUSE_BUCKETS ? bucket : Stats::PAUSE_BUCKETS - 1];
+    if (_h->stats_pending) {
+        _h->stats_pending = 0;
+        if (_h->callback) _h->callback(stats->last, _h->callback_data);
+    }
+}
+
+
+//get the time since the last lap of a clock, and start a new lap
+static inline size_t _lap(size_t *clock)
+{
+    size_t now = _now(), micros = now - *clock;
+    *clock = now;
+    return micros;
+}
+
+
+//count a collection in the statistics; the bytes it freed do not include
+//the ones of the collections it did first; it is reported when its pause
+//ends
+static void _count_collection(CollectionStats *record, size_t start, size_t freed_bytes)
+{
+    record->pauseMicros = _now() - start;
+    record->liveBytes = _h->alloc_size + _h->young_size + _h->large_size;
+    if (record->full) ++_h->stats.collections;
+    else ++_h->stats.minorCollections;
+    _h->stats.freedBytes += freed_bytes;
+    _h->stats.last = *record;
+    _h->stats_pending = 1;
+}
+
+
+//scan the marked blocks again after the mark stack overflowed; the blocks
+//that did not fit in the stack are among them
+static void _recover_overflow()
+{
+    size_t i, w, bits;
+    _h->gray_overflow = 0;
+    for(i = 0, w = 0; i < _h->curr_block; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->marks[w] & ~_h->deletes[w], i, _h->curr_block);
+        for(; bits; bits &= bits - 1) _mark_members(&_h->blocks[i + lowestBit(bits)]);
+    }
+    for(i = 0, w = 0; i < _h->large_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->large_marks[w] & ~_h->large_deletes[w], i, _h->large_count);
+        for(; bits; bits &= bits - 1) _mark_members(&_h->large[i + lowestBit(bits)]);
+    }
+    if (_h->marking) return;
+    for(i = 0, w = 0; i < _h->young_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->young_marks[w] & ~_h->young_deletes[w], i, _h->young_count);
+        for(; bits; bits &= bits - 1) _mark_members(&_h->young[i + lowestBit(bits)]);
+    }
+}
+
+
+//process gray blocks until there are no more or the deadline passes;
+//a zero deadline means no deadline; returns true if marking is complete
+static bool _drain(size_t deadline)
+{
+    _prefetch_fifo fifo = { { 0 }, 0, 0 };
+    _basic_ptr *p;
+    size_t work = 0;
+    for(;;) {
+        //scan gray blocks; their targets are marked as they leave the
+        //prefetch pipeline
+        while (_h->gray_count) {
+            _block *block = _h->gray[--_h->gray_count];
+            _ptr_cursor c;
+            _first_ptr(&c, block);
+            while (_basic_ptr *ptr = _next_ptr(&c)) {
+                if ((p = _fifo_push(&fifo, ptr))) _mark(p);
+            }
+
+            //check the clock every few blocks
+            if (deadline && ++work % _DRAIN_CHECK_INTERVAL == 0 && _now() >= deadline) {
+                while ((p = _fifo_pop(&fifo))) _mark(p);
+                return !_h->gray_count && !_h->gray_overflow;
+            }
+        }
+
+        //mark the targets left in the pipeline; they may make more blocks gray
+        if (fifo.count) {
+            while ((p = _fifo_pop(&fifo))) _mark(p);
+            continue;
+        }
+
+        //marking is complete unless the mark stack overflowed
+        if (!_h->gray_overflow) return true;
+        _recover_overflow();
+    }
+}
+
+
+#if GC_MARK_THREADS > 1
+//initial number of blocks of a work-stealing deque
+#define _DEQUE_SIZE          1024
+
+
+//array of a work-stealing deque
+struct _deque_array {
+    size_t size;
+    _deque_array *retired;
+    _block *items[1];
+};
+
+
+//work-stealing deque of gray blocks (Chase-Lev); its marker pushes and
+//pops blocks at the bottom, while the other markers steal from the top
+struct _deque {
+    volatile size_t top;
+    volatile size_t bottom;
+    _deque_array *volatile array;
+    char padding[64 - 3 * sizeof(size_t)];
+};
+
+
+//allocate the array of a deque
+static _deque_array *_new_deque_array(size_t size, _deque_array *retired)
+{
+    _deque_array *array = (_deque_array *)malloc(sizeof(_deque_array) + (size - 1) * sizeof(_block *));
+    if (!array) {
+        fprintf(stderr, "gc: out of mark stack memory\n");
+        exit(-1);
+    }
+    array->size = size;
+    array->retired = retired;
+    return array;
+}
+
+
+//push a block at the bottom of a deque
+static void _deque_push(_deque *d, _block *block)
+{
+    size_t b = d->bottom, t = d->top;
+    _deque_array *array = d->array;
+
+    //if the array is full, grow it; the old one may still be read by
+    //thieves, so it is freed when the marking is complete
+    if (b - t >= array->size - 1) {
+        _deque_array *new_array = _new_deque_array(array->size * 2, array);
+        for(size_t i = t; i != b; ++i) {
+            new_array->items[i & (new_array->size - 1)] = array->items[i & (array->size - 1)];
+        }
+        atomicFence();
+        d->array = array = new_array;
+    }
+
+    array->items[b & (array->size - 1)] = block;
+    atomicFence();
+    d->bottom = b + 1;
+}
+
+
+//pop a block from the bottom of a deque; returns null if it is empty
+static _block *_deque_pop(_deque *d)
+{
+    size_t b = d->bottom - 1;
+    _deque_array *array = d->array;
+    d->bottom = b;
+    atomicFence();
+    size_t t = d->top;
+
+    //empty
+    if ((ptrdiff_t)(b - t) < 0) {
+        d->bottom = t;
+        return 0;
+    }
+
+    //more than one block
+    _block *block = array->items[b & (array->size - 1)];
+    if (b != t) return block;
+
+    //last block; thieves may take it
+    if (!atomicCas(&d->top, t, t + 1)) block = 0;
+    d->bottom = t + 1;
+    return block;
+}
+
+
+//steal a block from the top of a deque; returns false if the deque is
+//empty; the block is null if another marker took it first
+static bool _deque_steal(_deque *d, _block **block)
+{
+    size_t t = d->top;
+    atomicFence();
+    size_t b = d->bottom;
+    *block = 0;
+    if ((ptrdiff_t)(b - t) <= 0) return false;
+    _deque_array *array = d->array;
+    _block *item = array->items[t & (array->size - 1)];
+    if (atomicCas(&d->top, t, t + 1)) *block = item;
+    return true;
+}
+
+
+//mark a block atomically, given its index and the mark bitmap of its
+//table; returns true if this marker marked it
+static inline bool _try_mark(size_t *marks, size_t index)
+{
+    size_t *word = &marks[index / _WORD_BITS], bit = (size_t)1 << (index % _WORD_BITS);
+    return !(*word & bit) && !(atomicOr(word, bit) & bit);
+}
+
+
+//mark the blocks reachable from the pointers of a block and push them
+//in the deque of the marker
+static void _mark_members_parallel(_block *block, _deque *d)
+{
+    _ptr_cursor c;
+    _first_ptr(&c, block);
+    while (_basic_ptr *ptr = _next_ptr(&c)) {
+        if (ptr->object && !ptr->weak) {
+            size_t index, *marks, *locks;
+            _block *target = _object_state(ptr->object, &index, &marks, &locks);
+            if (!_test_bit(locks, index) && _try_mark(marks, index) && _traced(target)) _deque_push(d, target);
+        }
+    }
+}
+
+
+//checks if any deque has blocks
+static bool _deques_have_blocks()
+{
+    for(size_t i = 0; i < GC_MARK_THREADS; ++i) {
+        if ((ptrdiff_t)(_h->deques[i].bottom - _h->deques[i].top) > 0) return true;
+    }
+    return false;
+}
+
+
+//mark in parallel until all markers run out of blocks
+static void _mark_parallel(size_t id)
+{
+    _deque *d = &_h->deques[id];
+    for(;;) {
+        //process own blocks
+        _block *block;
+        while ((block = _deque_pop(d)) != 0) {
+            _mark_members_parallel(block, d);
+        }
+
+        //steal blocks from the other markers
+        bool contended = false;
+        for(size_t i = 1; i < GC_MARK_THREADS && !block; ++i) {
+            if (_deque_steal(&_h->deques[(id + i) % GC_MARK_THREADS], &block) && !block) {
+                contended = true;
+            }
+        }
+        if (block) {
+            _mark_members_parallel(block, d);
+            continue;
+        }
+        if (contended) continue;
+
+        //a marker becomes idle only when all deques are empty, and idle
+        //markers do not push blocks; so when all markers are idle, the
+        //marking is complete
+        atomicAdd(&_h->markers_idle, 1);
+        for(;;) {
+            if (_h->markers_idle == GC_MARK_THREADS) return;
+            if (_deques_have_blocks()) {
+                atomicAdd(&_h->markers_idle, (size_t)-1);
+                break;
+            }
+            yieldThread();
+        }
+    }
+}
+
+
+//worker thread of a heap; it runs each job it is given
+static THREAD_PROC(_workers_proc)
+{
+    _h = (_heap *)param;
+    size_t id = atomicAdd(&_h->workers_started, 1), round = 0;
+    lockMutex(&_h->workers_mutex);
+    for(;;) {
+        while (_h->workers_round == round && !_h->workers_exit) waitCond(&_h->workers_cond, &_h->workers_mutex);
+        if (_h->workers_exit) break;
+        round = _h->workers_round;
+        unlockMutex(&_h->workers_mutex);
+        _h->workers_job(id);
+        lockMutex(&_h->workers_mutex);
+        ++_h->workers_done;
+        notifyCond(&_h->workers_cond);
+    }
+    unlockMutex(&_h->workers_mutex);
+    return 0;
+}
+
+
+//run a job on all worker threads; the calling thread is the first of them
+static void _run_workers(void (*job)(size_t id))
+{
+    //wake the other workers
+    lockMutex(&_h->workers_mutex);
+    _h->workers_job = job;
+    ++_h->workers_round;
+    _h->workers_done = 0;
+    notifyCond(&_h->workers_cond);
+    unlockMutex(&_h->workers_mutex);
+
+    job(0);
+
+    //wait for the other workers
+    lockMutex(&_h->workers_mutex);
+    while (_h->workers_done < GC_MARK_THREADS - 1) waitCond(&_h->workers_cond, &_h->workers_mutex);
+    unlockMutex(&_h->workers_mutex);
+}
+
+
+//mark blocks reachable from the gray blocks with all marking threads; the
+//calling thread is one of them
+static void _drain_parallel()
+{
+    size_t i;
+
+    //distribute the gray blocks, which come from the root set, among the
+    //markers
+    for(i = 0; i < _h->gray_count; ++i) _deque_push(&_h->deques[i % GC_MARK_THREADS], _h->gray[i]);
+    _h->gray_count = 0;
+    _h->markers_idle = 0;
+    _run_workers(_mark_parallel);
+
+    //free the arrays the deques have outgrown
+    for(i = 0; i < GC_MARK_THREADS; ++i) {
+        _deque_array *array = _h->deques[i].array->retired;
+        _h->deques[i].array->retired = 0;
+        while (array) {
+            _deque_array *retired = array->retired;
+            free(array);
+            array = retired;
+        }
+    }
+}
+#endif
+
+
+#if GC_CONCURRENT == 1
+//mark a batch of gray blocks without holding the lock; the blocks do not
+//move while they are scanned, since a collection that finishes the marking
+//waits for the batch; pointers stored meanwhile are handled by the barrier
+static void _mark_batch()
+{
+    //take a batch of gray blocks
+    while (_h->gray_count && _h->marker_batch_count < _MARKER_BATCH) {
+        _h->marker_batch[_h->marker_batch_count++] = _h->gray[--_h->gray_count];
+    }
+
+    //collect the targets of their pointers
+    Object *targets[_MARKER_TARGETS];
+    size_t i, target_count = 0;
+    lockMutex(&_h->marker_mutex);
+    unlock();
+    for(i = 0; i < _h->marker_batch_count; ++i) {
+        _block *block = _h->marker_batch[i];
+        size_t count = target_count;
+        _ptr_cursor c;
+        _first_ptr(&c, block);
+        while (c.bp && count < _MARKER_TARGETS) {
+            _basic_ptr *ptr = _next_ptr(&c);
+            if (!ptr->weak) targets[count++] = ptr->object;
+        }
+        if (c.bp) break;
+        target_count = count;
+    }
+    unlockMutex(&_h->marker_mutex);
+    lock();
+
+    //if a collection finished the marking meanwhile, it processed the batch
+    if (!_h->marker_batch_count) return;
+
+    //mark the targets; blocks whose pointers did not fit are scanned now
+    for(size_t j = 0; j < target_count; ++j) _shade(targets[j]);
+    while (_h->marker_batch_count > i) _mark_members(_h->marker_batch[--_h->marker_batch_count]);
+    _h->marker_batch_count = 0;
+}
+
+
+//marking thread; it waits for a marking that has gray blocks
+static THREAD_PROC(_marker_proc)
+{
+    _h = (_heap *)param;
+    lock();
+    while (!_h->marker_exit) {
+        if (_h->marking && _h->gray_count) _mark_batch();
+        else waitLock();
+    }
+    unlock();
+    return 0;
+}
+#endif
+
+
+#if GC_MARK_SWEEP == 1
+//bytes of a page of the old generation
+#define _PAGE_SIZE           16384
+
+
+//blocks bigger than this take a run of whole pages
+#define _MAX_CELL_SIZE       (_PAGE_SIZE / 4)
+
+
+//granularity of the size classes of cells
+#define _CELL_ALIGN          16
+
+
+//no page
+#define _NO_PAGE             ((size_t)-1)
+
+
+//kinds of pages
+enum _page_kind {
+    _PAGE_FREE,
+    _PAGE_CELLS,
+    _PAGE_LARGE
+};
+
+
+//page descriptor; a page of cells is split in cells of its size class, and
+//a large block takes a run of pages
+struct _page {
+    size_t kind;
+    size_t size_class;
+    size_t first;
+    size_t count;
+    size_t live;
+    char *free_cell;
+    char *top;
+    size_t prev;
+    size_t next;
+};
+
+
+//size classes of cells; they are the same for all heaps
+static size_t _class_size[_MAX_CLASSES];
+static unsigned char _class_of[_MAX_CELL_SIZE / _CELL_ALIGN + 1];
+
+
+//set up the size classes: four classes per doubling of the size
+static void _init_size_classes()
+{
+    size_t c = 0, size = _CELL_ALIGN, step = _CELL_ALIGN;
+    for(; size <= _MAX_CELL_SIZE; size += step) {
+        _h->class_pages[c] = _NO_PAGE;
+        _class_size[c++] = size;
+        if (size >= step * 8) step *= 2;
+    }
+    for(size_t i = 0, j = 0; i <= _MAX_CELL_SIZE / _CELL_ALIGN; ++i) {
+        while (_class_size[j] < i * _CELL_ALIGN) ++j;
+        _class_of[i] = (unsigned char)j;
+    }
+}
+
+
+//address of a page
+static inline char *_page_address(size_t p)
+{
+    return _h->memory + p * _PAGE_SIZE;
+}
+
+
+//checks if a page of cells has no free cells
+static inline bool _page_full(size_t p)
+{
+    return !_h->pages[p].free_cell && _h->pages[p].top + _class_size[_h->pages[p].size_class] > _page_address(p + 1);
+}
+
+
+//add a page to the list of its class
+static void _link_page(size_t p)
+{
+    size_t c = _h->pages[p].size_class;
+    _h->pages[p].prev = _NO_PAGE;
+    _h->pages[p].next = _h->class_pages[c];
+    if (_h->class_pages[c] != _NO_PAGE) _h->pages[_h->class_pages[c]].prev = p;
+    _h->class_pages[c] = p;
+}
+
+
+//remove a page from the list of its class
+static void _unlink_page(size_t p)
+{
+    if (_h->pages[p].prev != _NO_PAGE) _h->pages[_h->pages[p].prev].next = _h->pages[p].next;
+    else _h->class_pages[_h->pages[p].size_class] = _h->pages[p].next;
+    if (_h->pages[p].next != _NO_PAGE) _h->pages[_h->pages[p].next].prev = _h->pages[p].prev;
+}
+
+
+//allocate a run of pages; free pages are reused first, then pages are taken
+//from the end of the used memory; returns _NO_PAGE if there is no space
+static size_t _alloc_pages(size_t count)
+{
+    size_t i, run = 0, used = _h->free_index / _PAGE_SIZE;
+    if (_h->free_page_count >= count) {
+        for(i = 0; i < used; ++i) {
+            run = _h->pages[i].kind == _PAGE_FREE ? run + 1 : 0;
+            if (run == count) {
+                _h->free_page_count -= count;
+                return i + 1 - count;
+            }
+        }
+    }
+    if (used + count > _h->memory_size / _PAGE_SIZE) return _NO_PAGE;
+    _h->free_index += count * _PAGE_SIZE;
+    return used;
+}
+
+
+//free a run of pages; free pages at the end of the used memory are returned
+static void _release_pages(size_t first, size_t count)
+{
+    for(size_t i = first; i < first + count; ++i) _h->pages[i].kind = _PAGE_FREE;
+    _h->free_page_count += count;
+    while (_h->free_index && _h->pages[_h->free_index / _PAGE_SIZE - 1].kind == _PAGE_FREE) {
+        _h->free_index -= _PAGE_SIZE;
+        --_h->free_page_count;
+    }
+}
+
+
+//allocate a cell for a block of the given size; returns null if there is
+//no space
+static void *_alloc_cell(size_t size)
+{
+    size_t p, i;
+
+    //big blocks take a run of pages
+    if (size > _MAX_CELL_SIZE) {
+        size_t count = (size + _PAGE_SIZE - 1) / _PAGE_SIZE;
+        p = _alloc_pages(count);
+        if (p == _NO_PAGE) return 0;
+        for(i = p; i < p + count; ++i) {
+            _h->pages[i].kind = _PAGE_LARGE;
+            _h->pages[i].first = p;
+        }
+        _h->pages[p].count = count;
+        return _page_address(p);
+    }
+
+    //else take a cell of a page of the size class; if there is none with
+    //free cells, start a new one
+    size_t c = _class_of[(size + _CELL_ALIGN - 1) / _CELL_ALIGN];
+    p = _h->class_pages[c];
+    if (p == _NO_PAGE) {
+        p = _alloc_pages(1);
+        if (p == _NO_PAGE) return 0;
+        _h->pages[p].kind = _PAGE_CELLS;
+        _h->pages[p].size_class = c;
+        _h->pages[p].live = 0;
+        _h->pages[p].free_cell = 0;
+        _h->pages[p].top = _page_address(p);
+        _link_page(p);
+    }
+    _page *page = &_h->pages[p];
+    char *cell = page->free_cell;
+    if (cell) {
+        page->free_cell = *(char **)cell;
+    }
+    else {
+        cell = page->top;
+        page->top += _class_size[c];
+    }
+    ++page->live;
+
+    //a full page leaves the list of its class
+    if (_page_full(p)) _unlink_page(p);
+
+    return cell;
+}
+
+
+//free the cell of a block; a page without cells in use is freed
+static void _free_cell(void *cell)
+{
+    _clear_start(_h->starts, (char *)cell - _h->memory);
+    size_t p = ((char *)cell - _h->memory) / _PAGE_SIZE;
+    if (_h->pages[p].kind == _PAGE_LARGE) {
+        _release_pages(p, _h->pages[p].count);
+        return;
+    }
+
+    bool full = _page_full(p);
+    *(char **)cell = _h->pages[p].free_cell;
+    _h->pages[p].free_cell = (char *)cell;
+    if (--_h->pages[p].live == 0) {
+        if (!full) _unlink_page(p);
+        _release_pages(p, 1);
+    }
+    else if (full) {
+        _link_page(p);
+    }
+}
+
+
+//checks if a slot of the old generation is in an allocated block; the
+//header of a free cell holds the next free cell, not a block index
+static bool _in_block(void *slot, size_t block_count)
+{
+    //the pages of freed large blocks are free until the next allocation
+    if (_is_large(slot)) return _h->large_pages[((char *)slot - _h->large_space) / _LARGE_PAGE] == _LARGE_USED;
+
+    size_t p = ((char *)slot - _h->memory) / _PAGE_SIZE;
+    char *cell;
+    if (_h->pages[p].kind == _PAGE_LARGE) {
+        cell = _page_address(_h->pages[p].first);
+    }
+    else if (_h->pages[p].kind == _PAGE_CELLS) {
+        size_t size = _class_size[_h->pages[p].size_class];
+        cell = _page_address(p) + ((char *)slot - _page_address(p)) / size * size;
+    }
+    else {
+        return false;
+    }
+    size_t index = *(size_t *)cell;
+    return index < block_count && (char *)_h->blocks[index].object == cell + sizeof(size_t);
+}
+
+
+//sweep the old generation without moving objects: dead blocks are
+//finalized and their cells freed, and the block table is compacted;
+//returns the number of surviving blocks
+static size_t _sweep(size_t *new_alloc_size)
+{
+    size_t new_curr_block = 0;
+    _state_writer state;
+    _begin_state(&state, _h->locks, _h->deletes, 0);
+    *new_alloc_size = 0;
+    for(size_t i = 0, w = 0; i < _h->curr_block; i += _WORD_BITS, ++w) {
+        //the state of the blocks of a word is tested at once: locked blocks
+        //survive unless they are deleted, else marked blocks survive
+        size_t locks = _h->locks[w], deletes = _h->deletes[w];
+        size_t live = (locks & ~deletes) | (~locks & _h->marks[w]);
+        size_t end = _h->curr_block - i < _WORD_BITS ? _h->curr_block : i + _WORD_BITS;
+        for(size_t j = i; j < end; ++j, live >>= 1, locks >>= 1, deletes >>= 1) {
+            _block *block = &_h->blocks[j];
+            if (live & 1) {
+                *((size_t *)block->object - 1) = new_curr_block;
+                _write_state(&state, locks & 1, deletes & 1);
+                _h->blocks[new_curr_block++] = *block;
+                *new_alloc_size += block->size + sizeof(size_t);
+            }
+            else {
+                if (!(deletes & 1) && block->finalize) _finalize(block->object);
+                _free_cell((size_t *)block->object - 1);
+            }
+        }
+    }
+    _end_state(&state);
+    return new_curr_block;
+}
+
+
+//drop the slots of freed blocks from the remembered set
+static void _filter_remembered(size_t block_count)
+{
+    size_t count = 0;
+    for(size_t i = 0; i < _h->remembered_count; ++i) {
+        if (_in_block(_h->remembered[i], block_count)) _h->remembered[count++] = _h->remembered[i];
+    }
+    _h->remembered_count = count;
+}
+
+
+#elif GC_MARK_THREADS > 1
+//number of blocks of a region of the parallel compaction
+#define _REGION_BLOCKS       1024
+
+
+//region of the block table; each one is compacted by one worker
+struct _region {
+    size_t live_count;
+    size_t live_size;
+    size_t moved_size;
+    size_t locked_end;
+    size_t src_end;
+    size_t free_index;
+    size_t block_index;
+    volatile size_t moved;
+};
+
+
+//claim the next region to process; returns false if there are no more
+static inline bool _claim_region(size_t *r)
+{
+    *r = atomicAdd(&_h->regions_next, 1) - 1;
+    return *r < _h->region_count;
+}
+
+
+//sum the surviving blocks of regions; moved blocks slide to the end of
+//the last locked block of the region, if any
+static void _summarize_regions(size_t)
+{
+    size_t r;
+    while (_claim_region(&r)) {
+        _region *region = &_h->regions[r];
+        size_t i = r * _REGION_BLOCKS, end = i + _REGION_BLOCKS;
+        if (end > _h->curr_block) end = _h->curr_block;
+        region->live_count = region->live_size = region->moved_size = region->locked_end = 0;
+        region->moved = 0;
+        for(; i < end; ++i) {
+            _block *block = &_h->blocks[i];
+            if (!_survives(_h->marks, _h->locks, _h->deletes, i)) continue;
+            size_t size = block->size + sizeof(size_t);
+            ++region->live_count;
+            region->live_size += size;
+            if (_test_bit(_h->locks, i)) {
+                region->locked_end = (char *)block->object + block->size - _h->memory;
+                region->moved_size = 0;
+            }
+            else {
+                region->moved_size += size;
+            }
+        }
+        _block *last = &_h->blocks[end - 1];
+        region->src_end = (char *)last->object + last->size - _h->memory;
+    }
+}
+
+
+//calculate the new addresses of the surviving blocks of regions, and
+//compact their descriptors to the start of each region; the state bitmap
+//words of a region are its own, so they are compacted too
+static void _forward_regions(size_t)
+{
+    size_t r;
+    while (_claim_region(&r)) {
+        _region *region = &_h->regions[r];
+        size_t i = r * _REGION_BLOCKS, end = i + _REGION_BLOCKS;
+        if (end > _h->curr_block) end = _h->curr_block;
+        size_t free_index = region->free_index, count = 0;
+        _block *blocks = &_h->blocks[i];
+        _state_writer state;
+        _begin_state(&state, _h->locks, _h->deletes, i);
+        for(; i < end; ++i) {
+            if (!_survives(_h->marks, _h->locks, _h->deletes, i)) continue;
+            *((size_t *)_h->blocks[i].object - 1) = region->block_index + count;
+            blocks[count] = _h->blocks[i];
+            _write_state(&state, _test_bit(_h->locks, i), _test_bit(_h->deletes, i));
+            if (_test_bit(_h->locks, i)) {
+                free_index = (char *)_h->blocks[i].object + _h->blocks[i].size - _h->memory;
+            }
+            else {
+                blocks[count].new_object = (Object *)(_h->memory + free_index + sizeof(size_t));
+                free_index += _h->blocks[i].size + sizeof(size_t);
+            }
+            ++count;
+        }
+        _end_state(&state);
+    }
+}
+
+
+//adjust a pointer of the old generation; the target's block is not traced
+static inline void _fixup(_basic_ptr *p)
+{
+    if (!p->object || _is_young(p->object)) return;
+    _block *block = _get_block(p->object);
+    if (!_is_locked(block)) p->object = block->new_object;
+}
+
+
+//remember a slot from a worker thread
+static inline void _remember_parallel(_basic_ptr *p, Object *obj)
+{
+    if ((!_is_old(p) && !_is_large(p)) || !_is_young(obj)) return;
+    size_t index = atomicAdd(&_h->remembered_count, 1) - 1;
+    if (index < _MAX_REMEMBERED) _h->remembered[index] = p;
+}
+
+
+//adjust the pointers of the surviving blocks of regions; the blocks were
+//marked, so all their targets survive too
+static void _fixup_regions(size_t)
+{
+    size_t r;
+    while (_claim_region(&r)) {
+        _region *region = &_h->regions[r];
+        for(size_t i = region->block_index; i < region->block_index + region->live_count; ++i) {
+            _block *block = &_h->blocks[i];
+            char *new_object = _test_bit(_h->locks, i) ? (char *)block->object : (char *)block->new_object;
+            _ptr_cursor c;
+            _first_ptr(&c, block);
+            while (_basic_ptr *ptr = _next_ptr(&c)) {
+                _remember_parallel((_basic_ptr *)(new_object + ((char *)ptr - c.object)), ptr->object);
+                _fixup(ptr);
+            }
+        }
+    }
+}
+
+
+//move the surviving blocks of regions; a region overwrites memory of
+//earlier regions, so it waits for them to be moved first
+static void _move_regions(size_t)
+{
+    size_t r;
+    while (_claim_region(&r)) {
+        _region *region = &_h->regions[r];
+        for(size_t q = r; q > 0 && _h->regions[q - 1].src_end > region->free_index; --q) {
+            while (!_h->regions[q - 1].moved) yieldThread();
+        }
+        atomicFence();
+        for(size_t i = region->block_index; i < region->block_index + region->live_count; ++i) {
+            if (!_test_bit(_h->locks, i)) {
+                *((size_t *)_h->blocks[i].new_object - 1) = i;
+                memmove(_h->blocks[i].new_object, _h->blocks[i].object, _h->blocks[i].size);
+                _h->blocks[i].object = _h->blocks[i].new_object;
+            }
+        }
+        atomicFence();
+        region->moved = 1;
+    }
+}
+
+
+//sweep the old generation with all worker threads: dead blocks are
+//finalized, and the surviving blocks are given their new addresses and
+//indices; returns the number of surviving blocks
+static size_t _sweep_parallel(size_t *new_alloc_size)
+{
+    size_t i, r, w, bits;
+
+    //finalize dead blocks that could not be queued; destructors run on the
+    //collecting thread only
+    for(i = 0, w = 0; i < _h->curr_block; i += _WORD_BITS, ++w) {
+        bits = _scan_word(~(_h->locks[w] | _h->deletes[w] | _h->marks[w]), i, _h->curr_block);
+        for(; bits; bits &= bits - 1) {
+            _block *block = &_h->blocks[i + lowestBit(bits)];
+            if (block->finalize) _finalize(block->object);
+        }
+    }
+
+    //sum the regions, then compute where each one starts (prefix sum)
+    _h->region_count = (_h->curr_block + _REGION_BLOCKS - 1) / _REGION_BLOCKS;
+    _h->regions_next = 0;
+    _run_workers(_summarize_regions);
+    size_t free_index = 0, block_index = 0;
+    *new_alloc_size = 0;
+    for(r = 0; r < _h->region_count; ++r) {
+        _h->regions[r].free_index = free_index;
+        _h->regions[r].block_index = block_index;
+        free_index = (_h->regions[r].locked_end ? _h->regions[r].locked_end : free_index) + _h->regions[r].moved_size;
+        block_index += _h->regions[r].live_count;
+        *new_alloc_size += _h->regions[r].live_size;
+    }
+    _h->free_index = free_index;
+
+    //forward the blocks of each region, then join the compacted descriptors
+    _h->regions_next = 0;
+    _run_workers(_forward_regions);
+    _state_writer state;
+    _begin_state(&state, _h->locks, _h->deletes, 0);
+    for(r = 0; r < _h->region_count; ++r) {
+        memmove(&_h->blocks[_h->regions[r].block_index], &_h->blocks[r * _REGION_BLOCKS], _h->regions[r].live_count * sizeof(_block));
+        for(i = r * _REGION_BLOCKS; i < r * _REGION_BLOCKS + _h->regions[r].live_count; ++i) {
+            _write_state(&state, _test_bit(_h->locks, i), _test_bit(_h->deletes, i));
+        }
+    }
+    _end_state(&state);
+
+    return block_index;
+}
+
+
+//adjust pointers with all worker threads; the root set and the young
+//generation are adjusted by the collecting thread
+static void _fixup_parallel(size_t young_count)
+{
+    size_t i;
+
+    //adjust the root set
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        for(i = 0; i < stack->top; ++i) {
+            if (stack->slots[i]) _fixup(stack->slots[i]);
+        }
+    }
+
+    //adjust the pointers of young blocks; they are not moved
+    _ptr_cursor c;
+    _basic_ptr *ptr;
+    for(i = 0; i < young_count; ++i) {
+        _first_ptr(&c, &_h->young[i]);
+        while ((ptr = _next_ptr(&c))) _fixup(ptr);
+    }
+
+    //adjust the pointers of large blocks; they are not moved either
+    for(i = 0; i < _h->large_count; ++i) {
+        _first_ptr(&c, &_h->large[i]);
+        while ((ptr = _next_ptr(&c))) {
+            _remember(ptr, ptr->object);
+            _fixup(ptr);
+        }
+    }
+
+    //adjust the pointers of old blocks
+    _h->regions_next = 0;
+    _run_workers(_fixup_regions);
+    if (_h->remembered_count > _MAX_REMEMBERED) {
+        _h->remembered_count = _MAX_REMEMBERED;
+        _h->remembered_overflow = 1;
+    }
+}
+
+
+//move the surviving blocks with all worker threads
+static void _move_parallel()
+{
+    _h->regions_next = 0;
+    _run_workers(_move_regions);
+}
+
+
+#else
+//adjust a pointer; the block it points to is pushed to the mark stack, so
+//as that its pointers are adjusted too
+static void _adjust(_basic_ptr *p)
+{
+    //pointer is null
+    if (!p->object) return;
+
+    //get block
+    _block *block = _get_block(p->object);
+
+    //do nothing for locked blocks
+    if (_is_locked(block)) return;
+
+    //adjust pointer; young objects are not moved by a full collection
+    if (!_is_young(p->object)) p->object = block->new_object;
+
+    //push block; if the mark stack overflows, the block is left for
+    //_adjust_pointers to find
+    if (block->adjust_phase == _h->phase) return;
+    size_t count = _h->gray_count;
+    _push_gray(block);
+    if (_h->gray_count > count) block->adjust_phase = _h->phase;
+}
+
+
+//adjust the pointers of a block through a prefetch pipeline
+static void _adjust_members(_block *block, _prefetch_fifo *fifo)
+{
+    //the address the block will have after it is moved
+    char *new_object = _is_young(block->object) || _is_locked(block) ?
+        (char *)block->object : (char *)block->new_object;
+
+    _basic_ptr *p;
+    _ptr_cursor c;
+    _first_ptr(&c, block);
+    while (_basic_ptr *ptr = _next_ptr(&c)) {
+        //remember old-to-young pointers at their new address; young
+        //objects are not moved, so this can precede the adjustment
+        _remember((_basic_ptr *)(new_object + ((char *)ptr - c.object)), ptr->object);
+
+        if ((p = _fifo_push(fifo, ptr))) _adjust(p);
+    }
+}
+
+
+//adjust the pointers of a locked block
+static inline void _adjust_locked(_block *block, _prefetch_fifo *fifo)
+{
+    block->adjust_phase = _h->phase;
+    _adjust_members(block, fifo);
+}
+
+
+//adjust the pointers of the root set, of locked blocks and of the blocks
+//reachable from them; the block tables hold only live blocks by now
+static void _adjust_pointers(size_t block_count, size_t young_count)
+{
+    _prefetch_fifo fifo = { { 0 }, 0, 0 };
+    _basic_ptr *p;
+    size_t i, w, bits;
+
+    //next phase
+    _h->phase ^= 1;
+
+    //adjust the root set
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        for(i = 0; i < stack->top; ++i) {
+            if (stack->slots[i] && (p = _fifo_push(&fifo, stack->slots[i]))) _adjust(p);
+        }
+    }
+
+    //adjust pointers of locked blocks; they take the phase too, since they
+    //may be unlocked before the next collection, as finalized objects are
+    for(i = 0, w = 0; i < block_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->locks[w], i, block_count);
+        for(; bits; bits &= bits - 1) _adjust_locked(&_h->blocks[i + lowestBit(bits)], &fifo);
+    }
+    for(i = 0, w = 0; i < young_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->young_locks[w], i, young_count);
+        for(; bits; bits &= bits - 1) _adjust_locked(&_h->young[i + lowestBit(bits)], &fifo);
+    }
+    for(i = 0, w = 0; i < _h->large_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->large_locks[w], i, _h->large_count);
+        for(; bits; bits &= bits - 1) _adjust_locked(&_h->large[i + lowestBit(bits)], &fifo);
+    }
+
+    for(;;) {
+        //adjust pointers of the pushed blocks
+        while (_h->gray_count) _adjust_members(_h->gray[--_h->gray_count], &fifo);
+        if (fifo.count) {
+            while ((p = _fifo_pop(&fifo))) _adjust(p);
+            continue;
+        }
+
+        //if the mark stack overflowed, the blocks it could not hold are the
+        //live blocks that were not adjusted yet
+        if (!_h->gray_overflow) return;
+        _h->gray_overflow = 0;
+        for(i = 0; i < block_count; ++i) {
+            if (!_test_bit(_h->locks, i) && _h->blocks[i].adjust_phase != _h->phase) {
+                _h->blocks[i].adjust_phase = _h->phase;
+                _adjust_members(&_h->blocks[i], &fifo);
+            }
+        }
+        for(i = 0; i < young_count; ++i) {
+            if (!_test_bit(_h->young_locks, i) && _h->young[i].adjust_phase != _h->phase) {
+                _h->young[i].adjust_phase = _h->phase;
+                _adjust_members(&_h->young[i], &fifo);
+            }
+        }
+        for(i = 0; i < _h->large_count; ++i) {
+            if (!_test_bit(_h->large_locks, i) && _h->large[i].adjust_phase != _h->phase) {
+                _h->large[i].adjust_phase = _h->phase;
+                _adjust_members(&_h->large[i], &fifo);
+            }
+        }
+    }
+}
+#endif
+
+
+//commit the old generation up to the given size; returns false if it can
+//not grow
+static bool _commit_memory(size_t size)
+{
+    if (size <= _h->memory_size || !commitMemory(_h->memory + _h->memory_size, size - _h->memory_size) ||
+        !commitMemory(_h->starts, (size / _START_BYTES + 1) * sizeof(size_t))) {
+        return false;
+    }
+    _h->memory_size = size;
+    return true;
+}
+
+
+//grow the old generation to at least the given size; it doubles, so as
+//that it grows a few times only; returns false if it can not grow
+static bool _grow_memory(size_t min_size)
+{
+    size_t size = _h->memory_size;
+    while (size < min_size && size < _h->max_memory_size) size *= 2;
+    if (size > _h->max_memory_size) size = _h->max_memory_size;
+    return _commit_memory(size);
+}
+
+
+//size the old generation to the given size, but not under its initial
+//size nor the memory in use; it shrinks only when it is less than half, so
+//as that it does not shrink and grow back at every collection
+static void _size_memory(size_t size)
+{
+    size = (size + _MEMORY_ALIGN - 1) / _MEMORY_ALIGN * _MEMORY_ALIGN;
+    if (size < _h->min_memory_size) size = _h->min_memory_size;
+    if (size > _h->max_memory_size) size = _h->max_memory_size;
+    if (size > _h->memory_size) {
+        _commit_memory(size);
+    }
+    else if (size < _h->memory_size / 2 && size >= _h->free_index) {
+        decommitMemory(_h->memory + size, _h->memory_size - size);
+        _h->memory_size = size;
+    }
+}
+
+
+//pace the next full collection at the end of one that started at the given
+//time: it is due when the old and large objects grow by the growth percent
+//of the bytes that survived; the share of the time it took sets the growth,
+//and the old generation is sized for the objects it will get
+static void _pace(size_t start)
+{
+    //without pacing, the old generation grows when it is more than half used
+    if (!_h->growth_percent) {
+        if (_h->free_index > _h->memory_size / 2) _grow_memory(_h->free_index * 2);
+        return;
+    }
+
+    //the share of the time since the last full collection that this one
+    //took; the collections of the young generation do not depend on the
+    //pacing, so they are not counted
+    size_t now = _now();
+    size_t elapsed = now - _h->paced_at;
+    size_t paused = now - start;
+    if (_h->max_pause_share && paused * 100 > elapsed * _h->max_pause_share) {
+        if (_h->growth < _h->growth_percent * _MAX_GROWTH_FACTOR) _h->growth *= 2;
+    }
+    else if (paused * 200 < elapsed * _h->max_pause_share && _h->growth > _h->growth_percent) {
+        _h->growth = _h->growth / 2 > _h->growth_percent ? _h->growth / 2 : _h->growth_percent;
+    }
+    _h->paced_at = now;
+
+    //the trigger
+    size_t live = _h->alloc_size + _h->large_size;
+    size_t trigger = live + live / 100 * _h->growth;
+    _h->trigger = trigger > _h->min_trigger ? trigger : _h->min_trigger;
+
+    //the old generation holds the objects that survived and the ones that
+    //are promoted until the trigger, or until the blocks run out, since
+    //the block table does not grow
+    size_t room = _h->trigger - live;
+    if (_h->curr_block && (_h->max_blocks - _h->curr_block) < room / (_h->alloc_size / _h->curr_block + 1)) {
+        room = (_h->max_blocks - _h->curr_block) * (_h->alloc_size / _h->curr_block + 1);
+    }
+    _size_memory(_h->free_index + room);
+}
+
+
+//register a block in the old generation; returns null if there is no space
+static void *_alloc_block(size_t size, bool finalize, const size_t *map)
+{
+#if GC_MARK_SWEEP == 1
+    //no more blocks or memory
+    if (_h->curr_block == _h->max_blocks) return 0;
+    void *mem = _alloc_cell(size);
+    if (!mem) return 0;
+#else
+    //no more blocks or memory
+    if (_h->curr_block == _h->max_blocks || _h->free_index + size > _h->memory_size) {
+        return 0;
+    }
+
+    //calculate address of allocated memory
+    void *mem = _h->memory + _h->free_index;
+    _h->free_index += size;
+#endif
+
+    //allocate memory
+    _h->alloc_size += size;
+    _set_start(_h->starts, (char *)mem - _h->memory);
+
+    //register memory block
+    _block *block = &_h->blocks[_h->curr_block];
+    block->object = (Object *)((size_t *)mem + 1);
+    block->new_object = 0;
+    block->ptrs = (size_t)map;
+    block->size = size - sizeof(size_t);
+    block->adjust_phase = _h->phase;
+    block->kept = 0;
+    block->finalize = finalize;
+    block->weak = 0;
+    block->mapped = map != 0;
+    _set_new_state(_h->locks, _h->deletes, _h->curr_block);
+
+    //blocks allocated while marking are black
+    _set_mark(block);
+
+    //link memory block to block entry
+    *(size_t *)mem = _h->curr_block;
+    ++_h->curr_block;
+
+    return (size_t *)mem + 1;
+}
+
+
+//allocate a block in the large object space: the first run of free pages
+//that fits is taken, else the space grows; returns null if there is no space
+static void *_alloc_large(size_t size, bool finalize, const size_t *map)
+{
+    size_t count = (size + _LARGE_PAGE - 1) / _LARGE_PAGE, run, first;
+
+    //no more blocks
+    if (_h->large_count == _h->max_large_pages) return 0;
+
+    //find the pages
+    for(run = 0; run < _h->large_run_count && _h->large_runs[run].count < count; ++run);
+    if (run < _h->large_run_count) {
+        first = _h->large_runs[run].first;
+    }
+    else if (_h->large_top + count <= _h->max_large_pages) {
+        first = _h->large_top;
+    }
+    else {
+        return 0;
+    }
+
+    //commit the pages
+    char *mem = _h->large_space + first * _LARGE_PAGE;
+    if (!commitMemory(mem, count * _LARGE_PAGE)) return 0;
+    if (run < _h->large_run_count) {
+        _h->large_runs[run].first += count;
+        _h->large_runs[run].count -= count;
+    }
+    else {
+        _h->large_top += count;
+    }
+    memset(&_h->large_pages[first], _LARGE_USED, count);
+    for(size_t i = first; i < first + count; ++i) _h->large_first[i] = first;
+    _h->large_size += count * _LARGE_PAGE;
+
+    //register memory block
+    _block *block = &_h->large[_h->large_count];
+    block->object = (Object *)((size_t *)mem + 1);
+    block->new_object = 0;
+    block->ptrs = (size_t)map;
+    block->size = size - sizeof(size_t);
+    block->adjust_phase = _h->phase;
+    block->kept = 0;
+    block->finalize = finalize;
+    block->weak = 0;
+    block->mapped = map != 0;
+    _set_new_state(_h->large_locks, _h->large_deletes, _h->large_count);
+
+    //blocks allocated while marking are black
+    _set_mark(block);
+
+    //link memory block to block entry
+    *(size_t *)mem = _h->large_count | _LARGE_BIT;
+    ++_h->large_count;
+
+    return (size_t *)mem + 1;
+}
+
+
+//sweep the large object space: dead blocks are finalized and their pages
+//freed, and the block table is compacted; live blocks stay where they are;
+//returns the number of freed bytes
+static size_t _sweep_large()
+{
+    size_t i, end, count = 0, large_size = _h->large_size;
+
+    //pages that were not reused since the last collection are returned to
+    //the system
+    for(i = 0; i < _h->large_top; i = end + 1) {
+        for(end = i; end < _h->large_top && _h->large_pages[end] == _LARGE_DIRTY; ++end);
+        if (end > i) {
+            decommitMemory(_h->large_space + i * _LARGE_PAGE, (end - i) * _LARGE_PAGE);
+            memset(&_h->large_pages[i], _LARGE_FREE, end - i);
+        }
+    }
+
+    //free the pages of dead blocks
+    _state_writer state;
+    _begin_state(&state, _h->large_locks, _h->large_deletes, 0);
+    for(i = 0; i < _h->large_count; ++i) {
+        _block *block = &_h->large[i];
+        if (_survives(_h->large_marks, _h->large_locks, _h->large_deletes, i)) {
+            *((size_t *)block->object - 1) = count | _LARGE_BIT;
+            block->new_object = block->object;
+            _write_state(&state, _test_bit(_h->large_locks, i), _test_bit(_h->large_deletes, i));
+            _h->large[count++] = *block;
+        }
+        else {
+            if (!_test_bit(_h->large_deletes, i) && block->finalize) _finalize(block->object);
+            char *mem = (char *)block->object - sizeof(size_t);
+            size_t pages = (block->size + sizeof(size_t) + _LARGE_PAGE - 1) / _LARGE_PAGE;
+            memset(&_h->large_pages[(mem - _h->large_space) / _LARGE_PAGE], _LARGE_DIRTY, pages);
+            _h->large_size -= pages * _LARGE_PAGE;
+        }
+    }
+    _end_state(&state);
+    _h->large_count = count;
+
+    //decommitted pages at the end of the space are not in runs; the rest
+    //of the unused pages are
+    while (_h->large_top && _h->large_pages[_h->large_top - 1] == _LARGE_FREE) --_h->large_top;
+    _h->large_run_count = 0;
+    for(i = 0; i < _h->large_top; ++i) {
+        if (_h->large_pages[i] == _LARGE_USED) continue;
+        if (_h->large_run_count && _h->large_runs[_h->large_run_count - 1].first + _h->large_runs[_h->large_run_count - 1].count == i) {
+            ++_h->large_runs[_h->large_run_count - 1].count;
+        }
+        else {
+            _h->large_runs[_h->large_run_count].first = i;
+            _h->large_runs[_h->large_run_count++].count = 1;
+        }
+    }
+
+    return large_size - _h->large_size;
+}
+
+
+//keep a young object in the nursery
+static void _keep(_block *block)
+{
+    if (block->kept) return;
+    block->kept = 1;
+    _h->young_kept[_h->young_kept_count++] = block - _h->young;
+}
+
+
+//list a weak pointer to a young object; it is forwarded or cleared once
+//the survivors of the minor collection are promoted
+static void _defer_weak(_basic_ptr *p)
+{
+    if (_h->weak_count == _h->weak_size) {
+        size_t size = _h->weak_size ? _h->weak_size * 2 : _WEAK_SIZE;
+        _basic_ptr **slots = (_basic_ptr **)realloc(_h->weak_slots, size * sizeof(_basic_ptr *));
+        if (!slots) {
+            fprintf(stderr, "gc: out of weak pointer memory\n");
+            exit(-1);
+        }
+        _h->weak_slots = slots;
+        _h->weak_size = size;
+    }
+    _h->weak_slots[_h->weak_count++] = p;
+}
+
+
+//promote the young object a pointer points to
+static void _promote(_basic_ptr *p)
+{
+    //only pointers to young objects are interesting
+    if (!_is_young(p->object)) return;
+
+    //weak pointers do not promote their objects
+    if (p->weak) {
+        _defer_weak(p);
+        return;
+    }
+
+    //get block
+    _block *block = _get_block(p->object);
+
+    //already promoted
+    if (block->new_object) {
+        p->object = block->new_object;
+        return;
+    }
+
+    //locked objects can not be moved; finalized objects are not moved
+    //either, so as that they are not traced again, and they are freed when
+    //they are not reachable anymore
+    size_t *marks, *locks, *deletes;
+    size_t index = _block_maps(block, &marks, &locks, &deletes);
+    if (_test_bit(locks, index) || _test_bit(deletes, index) || block->kept) {
+        _keep(block);
+        return;
+    }
+
+    //copy the object to the old generation
+    void *mem = _alloc_block(block->size + sizeof(size_t), block->finalize, 0);
+    if (!mem) {
+        _h->promotion_failed = 1;
+        _keep(block);
+        return;
+    }
+    memcpy(mem, block->object, block->size);
+    _block *old_block = _get_block(mem);
+    old_block->ptrs = block->ptrs;
+    old_block->weak = block->weak;
+    old_block->mapped = block->mapped;
+    _set_locked(old_block, 0);
+
+    //while marking, the pointers of the promoted object were not processed
+    if (_h->marking) _push_gray(old_block);
+
+    //forward the object
+    block->new_object = (Object *)mem;
+    p->object = block->new_object;
+}
+
+
+//promote the young objects reachable from the pointers of a block
+static void _promote_members(_block *block)
+{
+    _ptr_cursor c;
+    _first_ptr(&c, block);
+    while (_basic_ptr *ptr = _next_ptr(&c)) {
+        _promote(ptr);
+        if (!ptr->weak) _remember(ptr, ptr->object);
+    }
+}
+
+
+//forward the listed weak pointers to the young objects that were promoted,
+//and clear the ones to young objects that were not reached; the pointers
+//to kept objects are left alone, and they are remembered again
+static void _forward_weak()
+{
+    for(size_t i = 0; i < _h->weak_count; ++i) {
+        _basic_ptr *p = _h->weak_slots[i];
+
+        //a slot may be listed more than once
+        if (!_is_young(p->object)) continue;
+
+        _block *block = _get_block(p->object);
+        if (block->new_object) {
+            p->object = block->new_object;
+        }
+        else if (!block->kept) {
+            p->object = 0;
+            ++_h->stats.clearedWeakPointers;
+        }
+        _remember(p, p->object);
+    }
+    _h->weak_count = 0;
+}
+
+
+#if GC_MULTITHREADED == 1
+//return the unused space of a buffer; its unused blocks are deleted
+static void _retire_tlab(_tlab *tlab)
+{
+    for(size_t i = tlab->index; i < tlab->end_index; ++i) {
+        _put_bit(_h->young_locks, i, 0);
+        _put_bit(_h->young_deletes, i, 1);
+    }
+    _h->young_size -= tlab->end - tlab->top;
+    tlab->top = tlab->end = 0;
+    tlab->index = tlab->end_index = 0;
+}
+
+
+//retire the buffers of all threads; threads that are allocating from them
+//are waited for, and the rest allocate with the lock from now on
+static void _retire_tlabs()
+{
+    ++_h->tlab_epoch;
+    atomicFence();
+    for(_tlab *tlab = _h->tlabs; tlab; tlab = tlab->next) {
+        while (tlab->busy) yieldThread();
+        _retire_tlab(tlab);
+    }
+}
+#endif
+
+
+//stop the threads from pushing and popping roots without the lock, so as
+//that the root stacks can be walked; threads that are pushing or popping
+//are waited for; stops nest
+static void _stop_roots()
+{
+#if GC_MULTITHREADED == 1
+    if (_h->roots_stopped++) return;
+    atomicFence();
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        while (stack->busy) yieldThread();
+    }
+#endif
+}
+
+
+//let the threads push and pop roots without the lock again
+static void _resume_roots()
+{
+#if GC_MULTITHREADED == 1
+    atomicRelease(&_h->roots_stopped, _h->roots_stopped - 1);
+#endif
+}
+
+
+//close the holes that roots destroyed out of order left in a root stack;
+//the roots above them move down, and their indices follow; the stack must
+//not be pushed or popped meanwhile
+static void _compact_roots(_root_stack *stack)
+{
+    size_t top = 0;
+    for(size_t i = 0; i < stack->top; ++i) {
+        _basic_ptr *ptr = stack->slots[i];
+        if (!ptr) continue;
+        ptr->index = top;
+        stack->slots[top++] = ptr;
+    }
+    stack->top = top;
+}
+
+
+//clear a weak pointer if its object did not survive the marking
+static inline void _clear_weak(_basic_ptr *p)
+{
+    if (!p->object) return;
+    size_t *marks, *locks, *deletes;
+    size_t index = _block_maps(_get_block(p->object), &marks, &locks, &deletes);
+    if (_survives(marks, locks, deletes, index)) return;
+    p->object = 0;
+    ++_h->stats.clearedWeakPointers;
+}
+
+
+//clear the weak pointers of the blocks of a table that have any; the
+//blocks that die are included, since they may be queued for finalization
+static void _clear_weak_table(_block *blocks, size_t count, const size_t *deletes)
+{
+    for(size_t i = 0; i < count; ++i) {
+        if (!blocks[i].weak || _test_bit(deletes, i)) continue;
+        _ptr_cursor c;
+        _first_ptr(&c, &blocks[i]);
+        while (_basic_ptr *ptr = _next_ptr(&c)) {
+            if (ptr->weak) _clear_weak(ptr);
+        }
+    }
+}
+
+
+//clear the weak pointers whose objects did not survive the marking of a
+//full collection; member weak pointers are looked for only once there are
+//any
+static void _clear_weak_pointers()
+{
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        for(size_t i = 0; i < stack->top; ++i) {
+            if (stack->slots[i] && stack->slots[i]->weak) _clear_weak(stack->slots[i]);
+        }
+    }
+    if (!_h->weak_members) return;
+    _clear_weak_table(_h->blocks, _h->curr_block, _h->deletes);
+    _clear_weak_table(_h->large, _h->large_count, _h->large_deletes);
+    _clear_weak_table(_h->young, _h->young_count, _h->young_deletes);
+}
+
+
+//queue a dead object for finalization; it is locked, so as that it and the
+//objects it reaches stay in place until its finalizer runs; returns false
+//if the queue can not grow, and then the object is finalized by the sweep
+static bool _queue_finalizer(_block *block)
+{
+    if (_h->finalize_count == _h->finalize_size) {
+        size_t size = _h->finalize_size ? _h->finalize_size * 2 : _FINALIZE_SIZE;
+        Object **queue = (Object **)realloc(_h->finalize_queue, size * sizeof(Object *));
+        if (!queue) return false;
+        _h->finalize_queue = queue;
+        _h->finalize_size = size;
+    }
+    _set_locked(block, 1);
+    _h->finalize_queue[_h->finalize_count++] = block->object;
+    return true;
+}
+
+
+//queue the dead objects of a table that have finalizers, and mark them;
+//returns true if any was queued
+static bool _queue_table(_block *blocks, size_t count, const size_t *marks, const size_t *locks, const size_t *deletes)
+{
+    size_t i, w, bits;
+    bool queued = false;
+    for(i = 0, w = 0; i < count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(~(marks[w] | locks[w] | deletes[w]), i, count);
+        for(; bits; bits &= bits - 1) {
+            _block *block = &blocks[i + lowestBit(bits)];
+            if (block->finalize && _queue_finalizer(block)) {
+                _set_mark(block);
+                _push_gray(block);
+                queued = true;
+            }
+        }
+    }
+    return queued;
+}
+
+
+//queue the dead objects that have finalizers at the end of the marking of a
+//full collection; the objects they reach are marked by draining the mark
+//stack again; returns true if any was queued
+static bool _queue_finalizers()
+{
+    bool queued = _queue_table(_h->blocks, _h->curr_block, _h->marks, _h->locks, _h->deletes);
+    queued |= _queue_table(_h->large, _h->large_count, _h->large_marks, _h->large_locks, _h->large_deletes);
+    queued |= _queue_table(_h->young, _h->young_count, _h->young_marks, _h->young_locks, _h->young_deletes);
+    return queued;
+}
+
+
+//queue the dead young objects that have finalizers at the end of a minor
+//collection; they are kept, so as that the objects they reach are promoted;
+//returns true if any was queued
+static bool _queue_young_finalizers()
+{
+    bool queued = false;
+    for(size_t i = 0; i < _h->young_count; ++i) {
+        _block *block = &_h->young[i];
+        if (block->finalize && !block->kept && !block->new_object && !_test_bit(_h->young_deletes, i) && _queue_finalizer(block)) {
+            _keep(block);
+            queued = true;
+        }
+    }
+    return queued;
+}
+
+
+//run the finalizers of queued objects, up to the given count; the objects
+//are deleted, which unlocks them, so as that a collection reclaims their
+//memory once the other queued objects do not point to them; the finalizers
+//run without the lock, a batch at a time that is taken from the queue while
+//the lock is held; the objects of a batch stay locked, and in place, until
+//they are deleted; a finalizer that allocates does not run the others, and
+//neither does another thread while they run; returns the number of objects
+//finalized
+static size_t _run_finalizers(size_t count)
+{
+    Object *batch[_FINALIZE_BATCH];
+    _leaf_finalizer finalizers[_FINALIZE_BATCH];
+    size_t done = 0;
+    lock();
+    if (_h->finalizing) {
+        unlock();
+        return 0;
+    }
+    _h->finalizing = 1;
+    while (done < count && _h->finalize_count) {
+        size_t size = 0;
+        for(; size < _FINALIZE_BATCH && done + size < count && _h->finalize_count; ++size) {
+            batch[size] = _h->finalize_queue[--_h->finalize_count];
+            finalizers[size] = _finalizer_of(batch[size]);
+        }
+        unlock();
+        for(size_t i = 0; i < size; ++i) _finalize(batch[i], finalizers[i]);
+        lock();
+        done += size;
+    }
+    _h->finalizing = 0;
+    unlock();
+    return done;
+}
+
+
+//compare the addresses of two young blocks, given their indices
+static int _compare_young(const void *a, const void *b)
+{
+    Object *obj_a = _h->young[*(const size_t *)a].object;
+    Object *obj_b = _h->young[*(const size_t *)b].object;
+    return obj_a < obj_b ? -1 : obj_a > obj_b;
+}
+
+
+//allocation in the nursery continues in the largest gap between the
+//objects that were kept by a minor collection, so as that a few locked
+//objects do not make the nursery look full
+static void _find_young_gap()
+{
+    size_t i, start = 0;
+    _h->young_index = _h->young_limit = 0;
+    for(i = 0; i < _h->young_count; ++i) _h->young_kept[i] = i;
+    qsort(_h->young_kept, _h->young_count, sizeof(size_t), _compare_young);
+    for(i = 0; i <= _h->young_count; ++i) {
+        _block *block = i < _h->young_count ? &_h->young[_h->young_kept[i]] : 0;
+        size_t end = block ? (char *)block->object - sizeof(size_t) - _h->nursery : _h->nursery_size;
+        if (end - start > _h->young_limit - _h->young_index) {
+            _h->young_index = start;
+            _h->young_limit = end;
+        }
+        if (block) start = (char *)block->object + block->size - _h->nursery;
+    }
+}
+
+
+//collect the young generation
+static size_t _collect_young()
+{
+    size_t i, w, bits;
+    size_t start = _begin_pause(), clock = start;
+    CollectionStats record = CollectionStats();
+#if GC_MULTITHREADED == 1
+    _retire_tlabs();
+#endif
+    _stop_roots();
+    size_t scan = _h->curr_block;
+    size_t young_size = _h->young_size;
+    size_t old_alloc_size = _h->alloc_size;
+    size_t cleared = _h->stats.clearedWeakPointers;
+    _h->promotion_failed = 0;
+
+    //locked young objects are roots
+    for(i = 0, w = 0; i < _h->young_count; i += _WORD_BITS, ++w) {
+        bits = _scan_word(_h->young_locks[w], i, _h->young_count);
+        for(; bits; bits &= bits - 1) _keep(&_h->young[i + lowestBit(bits)]);
+    }
+
+    //promote objects reachable from the root set; the holes of the root
+    //stacks are closed first, so as that they are not walked again
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        _compact_roots(stack);
+        for(i = 0; i < stack->top; ++i) _promote(stack->slots[i]);
+    }
+
+    //promote objects reachable from the old generation
+    size_t remembered_count = _h->remembered_count;
+    _h->remembered_count = 0;
+    if (_h->remembered_overflow) {
+        _h->remembered_overflow = 0;
+        for(i = 0, w = 0; i < scan; i += _WORD_BITS, ++w) {
+            bits = _scan_word(~_h->deletes[w], i, scan);
+            for(; bits; bits &= bits - 1) _promote_members(&_h->blocks[i + lowestBit(bits)]);
+        }
+        for(i = 0, w = 0; i < _h->large_count; i += _WORD_BITS, ++w) {
+            bits = _scan_word(~_h->large_deletes[w], i, _h->large_count);
+            for(; bits; bits &= bits - 1) _promote_members(&_h->large[i + lowestBit(bits)]);
+        }
+    }
+    else {
+        for(i = 0; i < remembered_count; ++i) {
+            _promote(_h->remembered[i]);
+            if (!_h->remembered[i]->weak) _remember(_h->remembered[i], _h->remembered[i]->object);
+        }
+    }
+
+    //promote objects reachable from promoted and kept objects; the weak
+    //pointers to the objects that were not reached are cleared, then the
+    //dead objects that have finalizers are kept, and so are the ones they
+    //reach
+    size_t kept = 0;
+    do {
+        while (scan < _h->curr_block || kept < _h->young_kept_count) {
+            while (scan < _h->curr_block) _promote_members(&_h->blocks[scan++]);
+            while (kept < _h->young_kept_count) {
+                _promote_members(&_h->young[_h->young_kept[kept++]]);
+            }
+        }
+        _forward_weak();
+    } while (_queue_young_finalizers());
+
+    record.markMicros = _lap(&clock);
+
+    //finalize the dead objects that could not be queued
+    for(i = 0; i < _h->young_count; ++i) {
+        if (!_h->young[i].kept && !_h->young[i].new_object && !_test_bit(_h->young_deletes, i) && _h->young[i].finalize) {
+            _finalize(_h->young[i].object);
+        }
+    }
+    record.finalizeMicros = _lap(&clock);
+
+    //keep the objects that were not promoted
+    size_t new_young_count = 0;
+    _h->young_size = 0;
+    memset(_h->young_starts, 0, (_h->nursery_size / _START_BYTES + 1) * sizeof(size_t));
+    _state_writer state;
+    _begin_state(&state, _h->young_locks, _h->young_deletes, 0);
+    for(i = 0; i < _h->young_count; ++i) {
+        if (_h->young[i].kept) {
+            *((size_t *)_h->young[i].object - 1) = new_young_count | _YOUNG_BIT;
+            _set_start(_h->young_starts, (char *)_h->young[i].object - sizeof(size_t) - _h->nursery);
+            _write_state(&state, _test_bit(_h->young_locks, i), _test_bit(_h->young_deletes, i));
+            _h->young[new_young_count] = _h->young[i];
+            _h->young[new_young_count].kept = 0;
+            _h->young_size += _h->young[i].size + sizeof(size_t);
+            ++new_young_count;
+        }
+    }
+    _end_state(&state);
+    _clear_marks(_h->young_marks, _h->young_count);
+    _h->young_count = new_young_count;
+    _h->young_kept_count = 0;
+    _find_young_gap();
+    _resume_roots();
+
+    //result is number of freed bytes
+    record.freedBytes = young_size - _h->young_size - (_h->alloc_size - old_alloc_size);
+    record.clearedWeakPointers = _h->stats.clearedWeakPointers - cleared;
+    _count_collection(&record, start, record.freedBytes);
+    _end_pause(start);
+    return record.freedBytes;
+}
+
+
+//start a marking; the young generation is emptied first, so as that
+//the marking processes as few young objects as possible
+static size_t _start_marking(bool incremental)
+{
+    size_t start = _begin_pause();
+    _stop_roots();
+    size_t young_freed_bytes = _collect_young();
+
+    //clear marks
+    _clear_marks(_h->marks, _h->curr_block);
+    _clear_marks(_h->large_marks, _h->large_count);
+
+    //mark blocks reachable from the root set
+    _h->marking = incremental;
+    _mark_roots();
+    _resume_roots();
+    _end_pause(start);
+
+    return young_freed_bytes;
+}
+
+
+//mark the blocks reachable from the gray blocks
+static void _mark_gray()
+{
+#if GC_MARK_THREADS > 1
+    _drain_parallel();
+
+    //the blocks the mark stack could not hold are found by a serial drain
+    if (_h->gray_overflow) _drain(0);
+#else
+    _drain(0);
+#endif
+}
+
+
+//collect garbage of both generations
+static size_t _collect()
+{
+    size_t i, young_freed_bytes;
+    size_t start = _begin_pause(), clock = start;
+    size_t cleared = _h->stats.clearedWeakPointers;
+    CollectionStats record = CollectionStats();
+    record.full = true;
+
+    //the root stacks are walked until the pointers are adjusted
+    _stop_roots();
+
+    //finish an incremental marking: the objects that were reachable when
+    //it started are marked or gray, and objects allocated since then are
+    //black; what remains is to mark the young objects that were skipped
+    if (_h->marking) {
+#if GC_CONCURRENT == 1
+        //wait for the marking thread to scan its batch, then process it
+        lockMutex(&_h->marker_mutex);
+        unlockMutex(&_h->marker_mutex);
+        while (_h->marker_batch_count) _mark_members(_h->marker_batch[--_h->marker_batch_count]);
+#endif
+        young_freed_bytes = _collect_young();
+        _h->marking = 0;
+        _mark_roots();
+
+        //young objects that were not promoted may be reachable from old ones
+        if (_h->remembered_overflow) {
+            for(i = 0; i < _h->curr_block; ++i) {
+                if (_is_marked(&_h->blocks[i])) _mark_members(&_h->blocks[i]);
+            }
+            for(i = 0; i < _h->large_count; ++i) {
+                if (_is_marked(&_h->large[i])) _mark_members(&_h->large[i]);
+            }
+        }
+        else {
+            for(i = 0; i < _h->remembered_count; ++i) _mark(_h->remembered[i]);
+        }
+    }
+
+    //else start a new marking
+    else {
+        young_freed_bytes = _start_marking(false);
+    }
+
+    //mark blocks reachable from the gray blocks, then from the dead objects
+    //that are queued for finalization; the weak pointers to the dead objects
+    //are cleared before
+    _mark_gray();
+    _clear_weak_pointers();
+    if (_queue_finalizers()) _mark_gray();
+    record.markMicros = _lap(&clock);
+
+    //process objects
+    size_t new_curr_block = 0, new_alloc_size = 0;
+#if GC_MARK_SWEEP == 0
+    size_t used_size = _h->free_index;
+#endif
+#if GC_MARK_SWEEP == 1
+    new_curr_block = _sweep(&new_alloc_size);
+#elif GC_MARK_THREADS > 1
+    new_curr_block = _sweep_parallel(&new_alloc_size);
+#else
+    _state_writer state;
+    _begin_state(&state, _h->locks, _h->deletes, 0);
+    _h->free_index = 0;
+    for(i = 0; i < _h->curr_block; ++i) {
+        //if block is locked, do nothing
+        if (_test_bit(_h->locks, i)) {
+            if (!_test_bit(_h->deletes, i)) {
+                *((size_t *)_h->blocks[i].object - 1) = new_curr_block;
+                _write_state(&state, 1, 0);
+                _h->blocks[new_curr_block] = _h->blocks[i];
+                new_alloc_size += _h->blocks[i].size + sizeof(size_t);
+                _h->free_index = (char *)_h->blocks[i].object + _h->blocks[i].size - _h->memory;
+                ++new_curr_block;
+            }
+        }
+
+        //else if block is marked, calculate new address
+        else if (_test_bit(_h->marks, i)) {
+            *((size_t *)_h->blocks[i].object - 1) = new_curr_block;
+            _write_state(&state, 0, _test_bit(_h->deletes, i));
+            _h->blocks[new_curr_block] = _h->blocks[i];
+            void *mem = _h->memory + _h->free_index;
+            _h->blocks[new_curr_block].new_object = (Object *)((size_t *)mem + 1);
+            new_alloc_size += _h->blocks[i].size + sizeof(size_t);
+            _h->free_index += _h->blocks[i].size + sizeof(size_t);
+            ++new_curr_block;
+        }
+
+        //else delete object, if it could not be queued for finalization
+        else if (!_test_bit(_h->deletes, i) && _h->blocks[i].finalize) {
+            _finalize(_h->blocks[i].object);
+        }
+    }
+    _end_state(&state);
+#endif
+    record.planMicros = _lap(&clock);
+
+    //process large objects; they are not moved
+    size_t large_freed_bytes = _sweep_large();
+
+    //process young objects; they are not moved
+    size_t new_young_count = 0, new_young_size = 0;
+    _state_writer young_state;
+    _begin_state(&young_state, _h->young_locks, _h->young_deletes, 0);
+    for(i = 0; i < _h->young_count; ++i) {
+        //finalized objects stay until they become unreachable
+        if (_survives(_h->young_marks, _h->young_locks, _h->young_deletes, i)) {
+            *((size_t *)_h->young[i].object - 1) = new_young_count | _YOUNG_BIT;
+            _write_state(&young_state, _test_bit(_h->young_locks, i), _test_bit(_h->young_deletes, i));
+            _h->young[new_young_count] = _h->young[i];
+            new_young_size += _h->young[i].size + sizeof(size_t);
+            ++new_young_count;
+        }
+        else if (!_test_bit(_h->young_locks, i) && !_test_bit(_h->young_deletes, i) && _h->young[i].finalize) {
+            _finalize(_h->young[i].object);
+        }
+    }
+    _end_state(&young_state);
+    record.finalizeMicros = _lap(&clock);
+
+#if GC_MARK_SWEEP == 1
+    //objects are not moved; only the slots of freed blocks are forgotten
+    _filter_remembered(new_curr_block);
+#else
+    //adjust pointers; the remembered set is rebuilt from the adjusted pointers
+    _h->remembered_count = 0;
+    _h->remembered_overflow = 0;
+#if GC_MARK_THREADS > 1
+    _fixup_parallel(new_young_count);
+#else
+    _adjust_pointers(new_curr_block, new_young_count);
+#endif
+    record.adjustMicros = _lap(&clock);
+
+    //move marked objects
+#if GC_MARK_THREADS > 1
+    _move_parallel();
+#else
+    for(i = 0; i < new_curr_block; ++i) {
+        if (!_test_bit(_h->locks, i)) {
+            *((size_t *)_h->blocks[i].new_object - 1) = i;
+            memmove(_h->blocks[i].new_object, _h->blocks[i].object, _h->blocks[i].size);
+            _h->blocks[i].object = _h->blocks[i].new_object;
+        }
+    }
+#endif
+
+    //the headers moved, so the start bitmap is rebuilt
+    memset(_h->starts, 0, (used_size / _START_BYTES + 1) * sizeof(size_t));
+    for(i = 0; i < new_curr_block; ++i) {
+        _set_start(_h->starts, (char *)_h->blocks[i].object - sizeof(size_t) - _h->memory);
+    }
+    record.moveMicros = _lap(&clock);
+#endif
+
+    //result is number of freed bytes
+    size_t freed_bytes = _h->alloc_size - new_alloc_size + _h->young_size - new_young_size + large_freed_bytes;
+
+    //store new statistics for next GC phase
+    _h->alloc_size = new_alloc_size;
+    _h->curr_block = new_curr_block;
+    _h->young_size = new_young_size;
+    _h->young_count = new_young_count;
+
+    //pace the next collection; the old generation grows or shrinks for it
+    _pace(start);
+
+    //promote the objects that did not fit in the old generation before
+    if (_h->promotion_failed) young_freed_bytes += _collect_young();
+    _resume_roots();
+
+#if GC_CONCURRENT == 1
+    //the next concurrent marking starts when half of the memory up to the
+    //trigger is used
+    size_t limit = _h->trigger < _h->memory_size ? _h->trigger : _h->memory_size;
+    _h->marker_trigger = _h->alloc_size + (limit > _h->alloc_size ? (limit - _h->alloc_size) / 2 : 0);
+#endif
+
+    record.freedBytes = young_freed_bytes + freed_bytes;
+    record.clearedWeakPointers = _h->stats.clearedWeakPointers - cleared;
+    _count_collection(&record, start, freed_bytes);
+    _end_pause(start);
+    return record.freedBytes;
+}
+
+
+//register a block of the young generation; returns the object's address
+static inline void *_register_young(size_t index, void *mem, size_t size, bool finalize, const size_t *map)
+{
+    _block *block = &_h->young[index];
+    block->object = (Object *)((size_t *)mem + 1);
+    block->new_object = 0;
+    block->ptrs = (size_t)map;
+    block->size = size - sizeof(size_t);
+    block->adjust_phase = _h->phase;
+    block->kept = 0;
+    block->finalize = finalize;
+    block->weak = 0;
+    block->mapped = map != 0;
+
+    //link memory block to block entry
+    *(size_t *)mem = index | _YOUNG_BIT;
+    _set_start(_h->young_starts, (char *)mem - _h->nursery);
+
+    return (size_t *)mem + 1;
+}
+
+
+#if GC_MULTITHREADED == 1
+//allocate memory from the buffer of the calling thread without holding the
+//lock; returns null if the thread has no valid buffer or it is full
+static void *_alloc_local(size_t size, bool finalize, const size_t *map)
+{
+    _tlab *tlab = _thread_tlab;
+    if (!tlab || _thread_tlab_serial != _h->serial) return 0;
+
+    //a collection either waits for the allocation, or it started a new
+    //epoch before it and the buffer is not used
+    void *mem = 0;
+    atomicStore(&tlab->busy, 1);
+    if (tlab->epoch == _h->tlab_epoch && tlab->top + size <= tlab->end && tlab->index < tlab->end_index) {
+        mem = _register_young(tlab->index++, tlab->top, size, finalize, map);
+        tlab->top += size;
+    }
+    atomicRelease(&tlab->busy, 0);
+    return mem;
+}
+
+
+//the buffer of an exiting thread is retired and can be reused
+static THREAD_EXIT_PROC(_tlab_exit)
+{
+    _tlab *tlab = (_tlab *)param;
+    _heap *prev = _enter(tlab->heap);
+    _retire_tlab(tlab);
+    tlab->owner = 0;
+    _leave(prev);
+}
+
+
+//give the calling thread a new buffer; returns false if there is no space
+static bool _refill_tlab()
+{
+    _tlab *tlab = _thread_tlab_serial == _h->serial ? _thread_tlab : 0;
+
+    //the buffer of the thread in the heap, if it used another heap since
+    if (!tlab) {
+        for(tlab = _h->tlabs; tlab && tlab->owner != &_thread_tlab; tlab = tlab->next);
+    }
+
+    //the first buffer of a thread; the one of a thread that exited is reused
+    if (!tlab) {
+        for(tlab = _h->tlabs; tlab && tlab->owner; tlab = tlab->next);
+        if (!tlab) {
+            tlab = (_tlab *)calloc(1, sizeof(_tlab));
+            if (!tlab) return false;
+            tlab->heap = _h;
+            tlab->next = _h->tlabs;
+            _h->tlabs = tlab;
+        }
+        tlab->owner = &_thread_tlab;
+        tlab->blocks = _TLAB_MIN_BLOCKS;
+        setThreadKey(_h->tlab_key, tlab);
+    }
+
+    //fit the blocks of the buffer to the sizes of the objects of the thread:
+    //if the blocks ran out, there are twice as many, and if the memory ran
+    //out, there are a few more than were used
+    else if (tlab->end) {
+        if (tlab->index == tlab->end_index) {
+            tlab->blocks = tlab->blocks * 2 > _TLAB_BLOCKS ? _TLAB_BLOCKS : tlab->blocks * 2;
+        }
+        else {
+            size_t used = tlab->index - (tlab->end_index - tlab->blocks);
+            tlab->blocks = used + used / 4 + 1 < _TLAB_MIN_BLOCKS ? _TLAB_MIN_BLOCKS : used + used / 4 + 1;
+        }
+    }
+    _retire_tlab(tlab);
+    _thread_tlab = tlab;
+    _thread_tlab_serial = _h->serial;
+
+    //if there is no space in the nursery, collect as _alloc_young does;
+    //buffers start at a word of the start bitmap, so as that threads do not
+    //share words of it
+    size_t blocks = tlab->blocks;
+    if (_h->young_count + blocks > _h->max_young_blocks || _START_ALIGN(_h->young_index) + _TLAB_SIZE > _h->young_limit) {
+        _collect_young();
+        if (_h->promotion_failed) _collect();
+        if (_h->young_count + blocks > _h->max_young_blocks || _START_ALIGN(_h->young_index) + _TLAB_SIZE > _h->young_limit) {
+            return false;
+        }
+    }
+    _h->young_index = _START_ALIGN(_h->young_index);
+
+    //the blocks of the buffer have the state of new blocks from the start,
+    //so as that the thread allocates them without the lock; the ones that
+    //are not allocated are deleted when the buffer is retired
+    for(size_t i = _h->young_count; i < _h->young_count + blocks; ++i) {
+        memset(&_h->young[i], 0, sizeof(_block));
+        _set_new_state(_h->young_locks, _h->young_deletes, i);
+    }
+
+    tlab->top = _h->nursery + _h->young_index;
+    tlab->end = tlab->top + _TLAB_SIZE;
+    tlab->index = _h->young_count;
+    tlab->end_index = _h->young_count + blocks;
+    tlab->epoch = _h->tlab_epoch;
+    _h->young_index += _TLAB_SIZE;
+    _h->young_size += _TLAB_SIZE;
+    _h->young_count += blocks;
+    return true;
+}
+#endif
+
+
+//allocate memory in the young generation; returns null if there is no space
+static void *_alloc_young(size_t size, bool finalize, const size_t *map)
+{
+    //objects that are too big go to the old generation
+    if (size > (_h->nursery_size / 4)) return 0;
+
+#if GC_MULTITHREADED == 1
+    //small objects are allocated from the buffer of the thread
+    if (size <= _TLAB_MAX_OBJECT) {
+        void *mem = _alloc_local(size, finalize, map);
+        if (mem) return mem;
+        if (_refill_tlab()) return _alloc_local(size, finalize, map);
+    }
+#endif
+
+    //if there is no space in the nursery, collect the young generation;
+    //if objects could not be promoted, collect both generations
+    if (_h->young_count == _h->max_young_blocks || _h->young_index + size > _h->young_limit) {
+        _collect_young();
+        if (_h->promotion_failed) _collect();
+        if (_h->young_count == _h->max_young_blocks || _h->young_index + size > _h->young_limit) {
+            return 0;
+        }
+    }
+
+    //calculate address of allocated memory
+    void *mem = _h->nursery + _h->young_index;
+
+    //allocate memory
+    _h->young_index += size;
+    _h->young_size += size;
+
+    //register memory block
+    _set_new_state(_h->young_locks, _h->young_deletes, _h->young_count);
+    return _register_young(_h->young_count++, mem, size, finalize, map);
+}
+
+
+//size of the block of an object, header included, aligned to 8 bytes
+static inline size_t _block_size(size_t size)
+{
+    return ((size + sizeof(size_t) + 7) >> 3) << 3;
+}
+
+
+//allocate memory; objects that have finalizers are finalized when they die
+static void *_alloc(size_t size, bool finalize, const size_t *map)
+{
+    bool large = size > _h->large_object_size && _h->large_space;
+
+    //fix size to include header information and be aligned to 8 bytes
+    size = _block_size(size);
+
+#if GC_CONCURRENT == 1
+    //the root set is scanned and the heap is compacted by the mutators, so
+    //as that the objects they use do not move under them; the marking
+    //thread does the rest
+    if (!_h->marking && _h->alloc_size >= _h->marker_trigger) {
+        _start_marking(true);
+        notifyLock();
+    }
+    else if (_h->marking && !_h->gray_count && !_h->marker_batch_count) {
+        _collect();
+    }
+#endif
+
+    //a full collection is due when the old and large objects grew past the
+    //trigger since the last one
+    if (_h->alloc_size + _h->large_size >= _h->trigger) _collect();
+
+    //big objects are allocated in the large object space; if there is no
+    //space, collect; if there is still no space, they are allocated as the
+    //other objects
+    void *mem;
+    if (large) {
+        mem = _alloc_large(size, finalize, map);
+        if (!mem) {
+            _collect();
+            mem = _alloc_large(size, finalize, map);
+        }
+        if (mem) return mem;
+    }
+
+    //most objects are allocated in the young generation
+    mem = _alloc_young(size, finalize, map);
+    if (mem) return mem;
+
+    //else allocate in the old generation; if there are no more blocks free
+    //or not enough memory, collect, and if there is still no space, grow it
+    mem = _alloc_block(size, finalize, map);
+    if (mem) return mem;
+    _collect();
+    mem = _alloc_block(size, finalize, map);
+    if (mem || !_grow_memory(_h->free_index + size)) return mem;
+
+    return _alloc_block(size, finalize, map);
+}
+
+
+//free memory block; its pointers are not traced anymore
+static void _free(void *p)
+{
+    _block *block = _get_block(p);
+
+    //its pointers are cleared, since the remembered set may still hold them
+    //and the objects they point to may be freed before the block; while a
+    //marking is in progress, their targets are shaded first, since they may
+    //have been copied to blocks that are scanned already
+    _ptr_cursor c;
+    _first_ptr(&c, block);
+    while (_basic_ptr *ptr = _next_ptr(&c)) {
+        if (_h->marking) _mark(ptr);
+        ptr->object = 0;
+    }
+
+    //a deleted block is unlocked at once, since nothing may use it after
+    //the lock is released; a finalized object is locked until then
+    _set_deleted(block, 1);
+    _set_locked(block, 0);
+    block->ptrs = 0;
+    block->mapped = 0;
+}
+
+
+//unlocks an object
+static void _unlock(void *p)
+{
+    _set_locked(_get_block(p), 0);
+}
+
+
+//allocate a table of a heap; the collector can not work without it
+static void *_alloc_table(size_t count, size_t size)
+{
+    void *table = calloc(count ? count : 1, size);
+    if (!table) {
+        fprintf(stderr, "gc: out of memory\n");
+        exit(-1);
+    }
+    return table;
+}
+
+
+//create a root stack of the heap
+static _root_stack *_new_root_stack()
+{
+    _root_stack *stack = (_root_stack *)_alloc_table(1, sizeof(_root_stack));
+    stack->slots = (_basic_ptr **)_alloc_table(_h->root_stack_size, sizeof(_basic_ptr *));
+    stack->size = _h->root_stack_size;
+#if GC_MULTITHREADED == 1
+    stack->heap = _h;
+#endif
+    stack->next = _h->root_stacks;
+    _h->root_stacks = stack;
+    return stack;
+}
+
+
+//get the root stack of the calling thread; it is called with the lock
+static _root_stack *_attach_roots()
+{
+#if GC_MULTITHREADED == 1
+    _root_stack *stack = _thread_roots_serial == _h->serial ? _thread_roots : 0;
+
+    //the stack of the thread in the heap, if it used another heap since
+    if (!stack) {
+        for(stack = _h->root_stacks; stack && stack->owner != &_thread_roots; stack = stack->next);
+    }
+
+    //the first stack of a thread; the one of a thread that exited is reused,
+    //along with the roots that are left in it
+    if (!stack) {
+        for(stack = _h->root_stacks; stack && stack->owner; stack = stack->next);
+        if (!stack) stack = _new_root_stack();
+        stack->owner = &_thread_roots;
+        setThreadKey(_h->roots_key, stack);
+    }
+    _thread_roots = stack;
+    _thread_roots_serial = _h->serial;
+    return stack;
+#else
+    return _h->root_stacks;
+#endif
+}
+
+
+#if GC_MULTITHREADED == 1
+//the root stack of an exiting thread can be reused
+static THREAD_EXIT_PROC(_roots_exit)
+{
+    _root_stack *stack = (_root_stack *)param;
+    _heap *prev = _enter(stack->heap);
+    stack->owner = 0;
+    stack->mutators = 0;
+    stack->safe = 0;
+    _leave(prev);
+}
+#endif
+
+
+//remove the root of a slot of a stack; the slots of the roots that were
+//removed out of order are popped along with the last one
+static inline void _drop_root(_root_stack *stack, size_t index)
+{
+    stack->slots[index] = 0;
+    while (stack->top && !stack->slots[stack->top - 1]) --stack->top;
+}
+
+
+//push a root pointer on the stack of the calling thread without holding
+//the lock; a copy takes the object of its source meanwhile, so as that the
+//object is not moved in between; returns false if the thread has no stack
+//yet, or it is full, or the roots are stopped, or the object must be
+//unlocked with the lock
+static inline bool _push_root(_basic_ptr *ptr, const _basic_ptr *src)
+{
+#if GC_MULTITHREADED == 1
+    _root_stack *stack = _thread_roots;
+    if (!stack || _thread_roots_serial != _h->serial || stack->top == stack->size) return false;
+
+    //a collection either waits for the push, or it stopped the roots
+    //before it and the root is pushed with the lock
+    bool pushed = false;
+    atomicStore(&stack->busy, 1);
+    if (!_h->roots_stopped && (src || !ptr->object || !_is_locked(_get_block(ptr->object)))) {
+        if (src) ptr->object = src->object;
+        ptr->index = stack->top;
+        ptr->root = 1;
+        stack->slots[stack->top++] = ptr;
+        pushed = true;
+    }
+    atomicRelease(&stack->busy, 0);
+    return pushed;
+#else
+    return false;
+#endif
+}
+
+
+//pop a root pointer from the stack of the calling thread without holding
+//the lock; returns false if it is not in that stack, or the roots are
+//stopped
+static inline bool _pop_root(_basic_ptr *ptr)
+{
+#if GC_MULTITHREADED == 1
+    _root_stack *stack = _thread_roots;
+    if (!stack || _thread_roots_serial != _h->serial) return false;
+    bool popped = false;
+    atomicStore(&stack->busy, 1);
+    if (!_h->roots_stopped && ptr->index < stack->top && stack->slots[ptr->index] == ptr) {
+        _drop_root(stack, ptr->index);
+        popped = true;
+    }
+    atomicRelease(&stack->busy, 0);
+    return popped;
+#else
+    return false;
+#endif
+}
+
+
+//move the slot of a root pointer of the stack of the calling thread to
+//another one, which is then the root; the source is left null, without a
+//slot until something is assigned to it; returns false if the source is
+//not in that stack, or the roots are stopped
+static inline bool _move_root(_basic_ptr *ptr, _basic_ptr *src)
+{
+    if (!src->root || src->heap != _h->id) return false;
+#if GC_MULTITHREADED == 1
+    _root_stack *stack = _thread_roots;
+    if (!stack || _thread_roots_serial != _h->serial) return false;
+    bool moved = false;
+    atomicStore(&stack->busy, 1);
+    if (!_h->roots_stopped && src->index < stack->top && stack->slots[src->index] == src) {
+#else
+    _root_stack *stack = _h->root_stacks;
+    bool moved = false;
+    if (src->index < stack->top && stack->slots[src->index] == src) {
+#endif
+        ptr->object = src->object;
+        ptr->index = src->index;
+        ptr->root = 1;
+        stack->slots[src->index] = ptr;
+        src->index = _NO_ROOT_SLOT;
+        src->object = 0;
+        moved = true;
+    }
+#if GC_MULTITHREADED == 1
+    atomicRelease(&stack->busy, 0);
+#endif
+    return moved;
+}
+
+
+//add root pointer; it is pushed on the stack of the calling thread; a full
+//stack is compacted, and it grows if that leaves it more than half full
+static void _add_root_ptr(_basic_ptr *ptr)
+{
+    _root_stack *stack = _attach_roots();
+    if (stack->top == stack->size) {
+        _compact_roots(stack);
+        if (stack->top > stack->size / 2) {
+            _basic_ptr **slots = stack->size * 2 <= _MAX_ROOT_STACK ?
+                (_basic_ptr **)realloc(stack->slots, stack->size * 2 * sizeof(_basic_ptr *)) : 0;
+            if (!slots) {
+                fprintf(stderr, "gc: out of root set memory\n");
+                exit(-1);
+            }
+            stack->slots = slots;
+            stack->size *= 2;
+        }
+    }
+    ptr->index = stack->top;
+    stack->slots[stack->top++] = ptr;
+}
+
+
+//delete root pointer; a root that another thread pushed is removed from its
+//stack while the roots are stopped
+static void _del_root_ptr(_basic_ptr *ptr)
+{
+    _root_stack *stack = _attach_roots();
+    if (ptr->index < stack->top && stack->slots[ptr->index] == ptr) {
+        _drop_root(stack, ptr->index);
+        return;
+    }
+    _stop_roots();
+    for(stack = _h->root_stacks; stack; stack = stack->next) {
+        if (ptr->index < stack->top && stack->slots[ptr->index] == ptr) break;
+    }
+    if (!stack) {
+        fprintf(stderr, "gc: internal error: invalid root pointer\n");
+        exit(-1);
+    }
+    _drop_root(stack, ptr->index);
+    _resume_roots();
+}
+
+
+//add pointer
+static void _add_ptr(_basic_ptr *ptr)
+{
+    //if inside the gc memory, then find block that it belongs
+    if (_is_young(ptr) || _is_old(ptr) || _is_large(ptr)) {
+        //if the pointer is inside the block, then add it in the list of
+        //pointers the block has
+        _block *block = _find_block(ptr);
+        if (ptr >= (void *)block->object && ptr < (void *)((char *)block->object + block->size)) {
+            //the pointers of an object that has a pointer map are in the
+            //map already
+            if (!block->mapped) {
+                ptr->index = block->ptrs;
+                block->ptrs = (char *)ptr - (char *)block->object;
+            }
+            ptr->root = 0;
+            _remember(ptr, ptr->object);
+
+            //full collections look for weak pointers in the blocks that
+            //have any
+            if (ptr->weak) {
+                block->weak = 1;
+                _h->weak_members = 1;
+            }
+            return;
+        }
+
+        //internal error!
+        fprintf(stderr, "gc: internal error: invalid member pointer\n");
+        exit(-1);
+    }
+
+    //otherwise it is a root pointer
+    else {
+        _add_root_ptr(ptr);
+        ptr->root = 1;
+    }
+}
+
+
+//get the heap of a pointer to an object; a member belongs to the heap of
+//the object it is in, and a root to the heap of its object, or to the heap
+//of the calling thread while it is null
+static inline _heap *_ptr_heap(const _basic_ptr *ptr, const Object *obj)
+{
+    _heap *heap = _heap_of(ptr);
+    return obj && !_in_heap(heap, ptr) ? _heap_of(obj) : heap;
+}
+
+
+#if GC_CONSERVATIVE == 1
+//checks if a root is found by the scans of the stacks of a heap: it is on
+//the stack of the calling thread, which must be a registered mutator of the
+//heap if the collector is multithreaded, so as that the collections stop it
+static inline bool _stack_root(const _basic_ptr *ptr, _heap *heap)
+{
+#if GC_MULTITHREADED == 1
+    if (!_thread_mutator || _thread_mutator_serial != heap->serial) return false;
+#endif
+    return _on_stack(ptr);
+}
+#endif
+
+
+//move a root to the heap of an object that is assigned to it; it leaves the
+//root stack of its previous heap, and it is pushed on a stack of the other
+//one as the object is assigned
+static void _move_to_heap(_basic_ptr *ptr, _heap *heap)
+{
+    if (ptr->index < _STACK_ROOT_SLOT) {
+        _heap *prev = _enter(_heaps[ptr->heap]);
+        _del_root_ptr(ptr);
+        _leave(prev);
+        ptr->index = _NO_ROOT_SLOT;
+    }
+#if GC_CONSERVATIVE == 1
+    //a root on a stack that the other heap does not scan gets a slot there
+    else if (ptr->index == _STACK_ROOT_SLOT && !_stack_root(ptr, heap)) {
+        ptr->index = _NO_ROOT_SLOT;
+    }
+#endif
+    ptr->object = 0;
+    ptr->heap = heap->id;
+}
+
+
+//set up a heap; the heap of the calling thread is the given one meanwhile
+static void _init_heap(_heap *heap, const HeapConfig &config)
+{
+    _heap *prev = _h;
+    _h = heap;
+
+    //configuration
+    _h->max_blocks = config.maxBlocks;
+    _h->root_stack_size = config.rootStackSize ? config.rootStackSize : 1;
+    if (_h->root_stack_size > _MAX_ROOT_STACK) _h->root_stack_size = _MAX_ROOT_STACK;
+    _h->nursery_size = config.nurserySize;
+    _h->max_young_blocks = config.nurserySize / _YOUNG_BLOCK_BYTES;
+    _h->max_memory_size = config.maxMemorySize;
+    _h->growth_percent = config.growthPercent;
+    _h->growth = config.growthPercent;
+    _h->min_trigger = config.minTriggerSize;
+    _h->max_pause_share = config.maxPauseShare;
+    _h->large_object_size = config.largeObjectSize;
+    _h->large_space_size = config.largeSpaceSize / _LARGE_PAGE * _LARGE_PAGE;
+    _h->max_large_pages = _h->large_space_size / _LARGE_PAGE;
+    _h->serial = ++_heap_serial;
+
+    //initialize locking
+    initLock();
+
+    //tables
+    _h->blocks = (_block *)_alloc_table(_h->max_blocks, sizeof(_block));
+    _h->marks = (size_t *)_alloc_table(_h->max_blocks / _WORD_BITS + 1, sizeof(size_t));
+    _h->locks = (size_t *)_alloc_table(_h->max_blocks / _WORD_BITS + 1, sizeof(size_t));
+    _h->deletes = (size_t *)_alloc_table(_h->max_blocks / _WORD_BITS + 1, sizeof(size_t));
+    _h->young = (_block *)_alloc_table(_h->max_young_blocks, sizeof(_block));
+    _h->young_kept = (size_t *)_alloc_table(_h->max_young_blocks, sizeof(size_t));
+    _h->young_marks = (size_t *)_alloc_table(_h->max_young_blocks / _WORD_BITS + 1, sizeof(size_t));
+    _h->young_locks = (size_t *)_alloc_table(_h->max_young_blocks / _WORD_BITS + 1, sizeof(size_t));
+    _h->young_deletes = (size_t *)_alloc_table(_h->max_young_blocks / _WORD_BITS + 1, sizeof(size_t));
+    _h->remembered = (_basic_ptr **)_alloc_table(_MAX_REMEMBERED, sizeof(_basic_ptr *));
+    _h->large_pages = (unsigned char *)_alloc_table(_h->max_large_pages, 1);
+    _h->large_runs = (_large_run *)_alloc_table(_h->max_large_pages / 2 + 1, sizeof(_large_run));
+    _h->large = (_block *)_alloc_table(_h->max_large_pages, sizeof(_block));
+    _h->large_marks = (size_t *)_alloc_table(_h->max_large_pages / _WORD_BITS + 1, sizeof(size_t));
+    _h->large_locks = (size_t *)_alloc_table(_h->max_large_pages / _WORD_BITS + 1, sizeof(size_t));
+    _h->large_deletes = (size_t *)_alloc_table(_h->max_large_pages / _WORD_BITS + 1, sizeof(size_t));
+    _h->large_first = (size_t *)_alloc_table(_h->max_large_pages, sizeof(size_t));
+    _h->young_starts = (size_t *)_alloc_table(_h->nursery_size / _START_BYTES + 1, sizeof(size_t));
+
+#if GC_MARK_SWEEP == 1
+    //pages and size classes of the old generation
+    _h->max_pages = _h->max_memory_size / _PAGE_SIZE;
+    _h->pages = (_page *)_alloc_table(_h->max_pages, sizeof(_page));
+    _init_size_classes();
+#elif GC_MARK_THREADS > 1
+    //regions of the parallel compaction
+    _h->regions = (_region *)_alloc_table(_h->max_blocks / _REGION_BLOCKS + 1, sizeof(_region));
+#endif
+
+    //the nursery
+    _h->nursery = (char *)reserveMemory(_h->nursery_size);
+    if (!_h->nursery || !commitMemory(_h->nursery, _h->nursery_size)) {
+        fprintf(stderr, "gc: out of memory\n");
+        exit(-1);
+    }
+    _h->young_limit = _h->nursery_size;
+
+    //reserve the address space of the old generation, and commit its
+    //initial memory
+    _h->memory_space = (char *)reserveMemory(_h->max_memory_size + _MEMORY_ALIGN);
+    _h->memory = _h->memory_space + (_MEMORY_ALIGN - (size_t)_h->memory_space % _MEMORY_ALIGN) % _MEMORY_ALIGN;
+    _h->memory_end = _h->memory + _h->max_memory_size;
+    _h->memory_size = config.memorySize / _MEMORY_ALIGN * _MEMORY_ALIGN;
+    if (_h->memory_size < _MEMORY_ALIGN) _h->memory_size = _MEMORY_ALIGN;
+    if (_h->memory_size > _h->max_memory_size) _h->memory_size = _h->max_memory_size;
+    _h->starts = (size_t *)reserveMemory((_h->max_memory_size / _START_BYTES + 1) * sizeof(size_t));
+    if (!_h->memory_space || !commitMemory(_h->memory, _h->memory_size) || !_h->starts ||
+        !commitMemory(_h->starts, (_h->memory_size / _START_BYTES + 1) * sizeof(size_t))) {
+        fprintf(stderr, "gc: out of memory\n");
+        exit(-1);
+    }
+#if GC_HUGE_PAGES == 1
+    adviseHugePages(_h->memory, _h->max_memory_size);
+#endif
+#if GC_PREFAULT == 1
+    prefaultMemory(_h->memory, _h->memory_size);
+#endif
+    _h->min_memory_size = _h->memory_size;
+
+    //the first full collection is due at the min trigger
+    _h->trigger = _h->growth_percent ? _h->min_trigger : (size_t)-1;
+    _h->paced_at = _now();
+#if GC_CONCURRENT == 1
+    _h->marker_trigger = (_h->trigger < _h->memory_size ? _h->trigger : _h->memory_size) / 2;
+#endif
+
+    //reserve the large object space; without it, big objects are allocated
+    //as the other objects
+    _h->large_space = _h->large_space_size ? (char *)reserveMemory(_h->large_space_size) : 0;
+    if (_h->large_space) _h->large_end = _h->large_space + _h->large_space_size;
+
+#if GC_MULTITHREADED == 1
+    //buffers of exiting threads are retired
+    _h->tlab_epoch = 1;
+    initThreadKey(&_h->tlab_key, _tlab_exit);
+#endif
+
+    //the root stacks; each thread gets its own when it adds its first root,
+    //and the stacks of exiting threads are reused
+#if GC_MULTITHREADED == 1
+    initThreadKey(&_h->roots_key, _roots_exit);
+#else
+    _new_root_stack();
+#endif
+
+#if GC_CONCURRENT == 1
+    //start the marking thread
+    initMutex(&_h->marker_mutex);
+    startThread(&_h->marker_thread, _marker_proc, _h);
+#endif
+
+#if GC_MARK_THREADS > 1
+    //start the worker threads; the collecting thread is the first
+    _h->deques = (_deque *)_alloc_table(GC_MARK_THREADS, sizeof(_deque));
+    initMutex(&_h->workers_mutex);
+    initCond(&_h->workers_cond);
+    for(size_t i = 0; i < GC_MARK_THREADS; ++i) {
+        _h->deques[i].array = _new_deque_array(_DEQUE_SIZE, 0);
+        if (i) startThread(&_h->workers[i], _workers_proc, _h);
+    }
+#endif
+
+    _h = prev;
+}
+
+
+//finalize the objects of a heap and free it; the heap of the calling
+//thread is the given one meanwhile
+static void _free_heap(_heap *heap)
+{
+    _heap *prev = _h;
+    _h = heap;
+
+#if GC_CONCURRENT == 1
+    //stop the marking thread
+    lock();
+    _h->marker_exit = 1;
+    notifyLock();
+    unlock();
+    joinThread(_h->marker_thread);
+    deleteMutex(&_h->marker_mutex);
+#endif
+
+#if GC_MARK_THREADS > 1
+    //stop the worker threads
+    lockMutex(&_h->workers_mutex);
+    _h->workers_exit = 1;
+    notifyCond(&_h->workers_cond);
+    unlockMutex(&_h->workers_mutex);
+    for(size_t i = 1; i < GC_MARK_THREADS; ++i) joinThread(_h->workers[i]);
+    deleteCond(&_h->workers_cond);
+    deleteMutex(&_h->workers_mutex);
+    for(size_t i = 0; i < GC_MARK_THREADS; ++i) free(_h->deques[i].array);
+    free(_h->deques);
+#endif
+
+    //finalize all blocks
+    lock();
+#if GC_MULTITHREADED == 1
+    _retire_tlabs();
+#endif
+    for(int i = _h->young_count - 1; i >= 0; --i) {
+        if (!_test_bit(_h->young_deletes, i) && _h->young[i].finalize) _finalize(_h->young[i].object);
+    }
+    for(int i = _h->curr_block - 1; i >= 0; --i) {
+        if (!_test_bit(_h->deletes, i) && _h->blocks[i].finalize) _finalize(_h->blocks[i].object);
+    }
+    for(int i = _h->large_count - 1; i >= 0; --i) {
+        if (!_test_bit(_h->large_deletes, i) && _h->large[i].finalize) _finalize(_h->large[i].object);
+    }
+    unlock();
+
+    //free the memory of the heap
+    if (_h->large_space) releaseMemory(_h->large_space, _h->large_space_size);
+    releaseMemory(_h->memory_space, _h->max_memory_size + _MEMORY_ALIGN);
+    releaseMemory(_h->starts, (_h->max_memory_size / _START_BYTES + 1) * sizeof(size_t));
+    releaseMemory(_h->nursery, _h->nursery_size);
+
+    //free the tables and the mark stack
+    free(_h->blocks);
+    free(_h->marks);
+    free(_h->locks);
+    free(_h->deletes);
+    free(_h->young);
+    free(_h->young_kept);
+    free(_h->young_marks);
+    free(_h->young_locks);
+    free(_h->young_deletes);
+    free(_h->remembered);
+    free(_h->large_pages);
+    free(_h->large_runs);
+    free(_h->large);
+    free(_h->large_marks);
+    free(_h->large_locks);
+    free(_h->large_deletes);
+    free(_h->large_first);
+    free(_h->young_starts);
+#if GC_MARK_SWEEP == 1
+    free(_h->pages);
+#elif GC_MARK_THREADS > 1
+    free(_h->regions);
+#endif
+    free(_h->gray);
+    free(_h->finalize_queue);
+    free(_h->weak_slots);
+#if GC_CONSERVATIVE == 1
+    free(_h->pinned);
+#endif
+
+#if GC_MULTITHREADED == 1
+    //free the thread-local allocation buffers; the root stacks of the
+    //threads are freed below
+    deleteThreadKey(_h->tlab_key);
+    if (_thread_tlab_serial == _h->serial) _thread_tlab = 0;
+    while (_h->tlabs) {
+        _tlab *next = _h->tlabs->next;
+        free(_h->tlabs);
+        _h->tlabs = next;
+    }
+    deleteThreadKey(_h->roots_key);
+    if (_thread_roots_serial == _h->serial) _thread_roots = 0;
+    if (_thread_mutator_serial == _h->serial) _thread_mutator = 0;
+#endif
+
+    //free the root stacks
+    while (_h->root_stacks) {
+        _root_stack *next = _h->root_stacks->next;
+        free(_h->root_stacks->slots);
+        free(_h->root_stacks);
+        _h->root_stacks = next;
+    }
+
+    //no more lock
+    deleteLock();
+
+    _h = prev == heap ? &_default_heap : prev;
+}
+
+
+//dynamic initialization
+__library::__library()
+{
+#if GC_CONSERVATIVE == 1
+    _find_stack();
+#endif
+    _init_heap(&_default_heap, HeapConfig());
+    _heaps[0] = &_default_heap;
+}
+
+
+//clean up
+__library::~__library()
+{
+    _free_heap(&_default_heap);
+}
+
+
+//constructor
+_library::_library()
+{
+    static __library library;
+}
+
+
+//default constructor; roots are pushed without the lock, if they can be,
+//and null members of an object that has a pointer map are not registered,
+//nor are pointers on a stack that is scanned
+_ptr::_ptr(Object *obj)
+{
+    object = obj;
+    weak = 0;
+    if (!obj && (char *)this >= _mapped_begin && (char *)this < _mapped_end) {
+        root = 0;
+        heap = _mapped_heap;
+        return;
+    }
+    _heap *prev = _h;
+    _h = _ptr_heap(this, obj);
+    heap = _h->id;
+#if GC_CONSERVATIVE == 1
+    if (_stack_root(this, _h)) {
+        root = 1;
+        index = _STACK_ROOT_SLOT;
+        if (obj) {
+            lock();
+            _unlock(obj);
+            unlock();
+        }
+        _h = prev;
+        return;
+    }
+#endif
+    if (_in_heap(_h, this) || !_push_root(this, 0)) {
+        lock();
+        if (obj) _unlock(obj);
+        _add_ptr(this);
+        unlock();
+    }
+    _h = prev;
+}
+
+
+//copy constructor
+_ptr::_ptr(const _ptr &ptr)
+{
+    object = ptr.object;
+    weak = 0;
+    _heap *prev = _h;
+    _h = _ptr_heap(this, ptr.object);
+    heap = _h->id;
+#if GC_CONSERVATIVE == 1
+    if (_stack_root(this, _h)) {
+        root = 1;
+        index = _STACK_ROOT_SLOT;
+        _h = prev;
+        return;
+    }
+#endif
+    if (_in_heap(_h, this) || !_push_root(this, &ptr)) {
+        lock();
+        object = ptr.object;
+        _add_ptr(this);
+        unlock();
+    }
+    _h = prev;
+}
 
-static void initLock() { pthread_mutex_init(&cr, NULL); }
-static void deleteLock() { pthread_mutex_destroy(&cr); }
 
-static void lock() {
-    if(!cr_alreadyLocked) {
-        pthread_mutex_lock(&cr);
-        cr_alreadyLocked = 1;
+#if GC_MOVE_SEMANTICS == 1
+//move constructor; a root takes the slot of the root it is moved from, and
+//else it is added as a copy and the source is cleared
+_ptr::_ptr(_ptr &&ptr) noexcept
+{
+    object = ptr.object;
+    weak = 0;
+    _heap *prev = _h;
+    _h = _ptr_heap(this, ptr.object);
+    heap = _h->id;
+#if GC_CONSERVATIVE == 1
+    if (_stack_root(this, _h)) {
+        root = 1;
+        index = _STACK_ROOT_SLOT;
+        _h = prev;
+        ptr = (Object *)0;
+        return;
     }
-}
+#endif
+    bool moved = !_in_heap(_h, this) && _move_root(this, &ptr);
+    if (!moved && (_in_heap(_h, this) || !_push_root(this, &ptr))) {
+        lock();
+        object = ptr.object;
+        _add_ptr(this);
+        unlock();
+    }
+    _h = prev;
 
-static void unlock() {
-    cr_alreadyLocked = 0;
-    pthread_mutex_unlock(&cr);
+    //a source that kept its registration is cleared
+    if (!moved) ptr = (Object *)0;
 }
 #endif
 
-//else single-threaded
-#else // WIN32
-//empty functions that will be removed by the compiler
-static void initLock() {}
-static void deleteLock() {}
-static void lock() {}
-static void unlock() {}
-#endif //GC_MULTITHREADED
-
-
-namespace gc {
-
 
-//max blocks
-#define _MAX_BLOCKS          262144
+//constructor of a weak pointer from raw pointer
+_ptr::_ptr(Object *obj, bool weak)
+{
+    object = obj;
+    this->weak = weak;
+    _heap *prev = _h;
+    _h = _ptr_heap(this, obj);
+    heap = _h->id;
+    if (_in_heap(_h, this) || !_push_root(this, 0)) {
+        lock();
+        if (obj) _unlock(obj);
+        _add_ptr(this);
+        unlock();
+    }
+    _h = prev;
+}
 
 
-//max roots
-#define _MAX_ROOTS           262144
+//constructor of a weak pointer from pointer
+_ptr::_ptr(const _ptr &ptr, bool weak)
+{
+    object = ptr.object;
+    this->weak = weak;
+    _heap *prev = _h;
+    _h = _ptr_heap(this, ptr.object);
+    heap = _h->id;
+    if (_in_heap(_h, this) || !_push_root(this, &ptr)) {
+        lock();
+        object = ptr.object;
+        _add_ptr(this);
+        unlock();
+    }
+    _h = prev;
+}
 
 
-//internal object for doing initialization and clean up
-struct __library {
-    //dynamic initialization
-    __library();
+//destructor; roots are popped without the lock, if they can be
+_ptr::~_ptr()
+{
+    if (!root || index >= _STACK_ROOT_SLOT) return;
+    _heap *prev = _h;
+    _h = _heaps[heap];
+    if (!_pop_root(this)) {
+        lock();
+        _del_root_ptr(this);
+        unlock();
+    }
+    _h = prev;
+}
 
-    //clean up
-    ~__library();
-};
 
+//assignment from raw pointer; a root moves to the heap of its new object
+void _ptr::operator = (Object *obj)
+{
+    if (obj == object) return;
+    if (root && obj && !_in_heap(_heaps[heap], obj)) _move_to_heap(this, _heap_of(obj));
+    _heap *ptr_heap = _heaps[heap];
+    if (!obj && !ptr_heap->marking) {
+        object = 0;
+        _safepoint(ptr_heap);
+        return;
+    }
+    _heap *prev = _enter(ptr_heap);
+    if (root && index == _NO_ROOT_SLOT) _add_root_ptr(this);
+    _write_barrier(this, obj);
+    if (obj) _unlock(obj);
+    _leave(prev);
+}
 
-//memory block descriptor
-struct _block {
-    Object *object;
-    Object *new_object;
-    size_t ptrs;
-    size_t size:28;
-    size_t mark_phase:1;
-    size_t adjust_phase:1;
-    size_t locked:1;
-    size_t deleted:1;
-};
 
+//assignment from pointer; a root moves to the heap of its new object
+void _ptr::operator = (const _ptr &ptr)
+{
+    if (root && ptr.object && ptr.heap != heap) _move_to_heap(this, _heaps[ptr.heap]);
+    _heap *prev = _h;
+    _h = _heaps[heap];
 
-//root pointer descriptor
-struct _root {
-    size_t prev;
-    size_t next;
-    _basic_ptr *ptr;
-};
+    //a root that was moved to another one gets a slot again
+    if (root && index == _NO_ROOT_SLOT && ptr.object) {
+        lock();
+        _add_root_ptr(this);
+        unlock();
+    }
 
+    //write barrier for old-to-young pointers and for marking
+    if (((_is_old(this) || _is_large(this)) && _is_young(ptr.object)) || _h->marking) {
+        lock();
+        _write_barrier(this, ptr.object);
+        unlock();
+    }
+    else {
+        object = ptr.object;
+        _safepoint(_h);
+    }
 
-//context
-static size_t _phase = 0;
-static char _memory[GC_MEMORY_SIZE];
-static size_t _alloc_size = 0;
-static size_t _free_index = 0;
-static _block _blocks[_MAX_BLOCKS];
-static size_t _curr_block = 0;
-static _root _roots[_MAX_ROOTS];
-static size_t _root_free = 1;
-static size_t _root_deleted = 0;
+    _h = prev;
+}
 
 
-//mark object reachable from pointer
-static void _mark(_basic_ptr *p)
+#if GC_MOVE_SEMANTICS == 1
+//move assignment; a root without a slot takes the slot of the root it is
+//moved from, and else the source is copied and cleared
+void _ptr::operator = (_ptr &&ptr) noexcept
 {
-    //pointer is null
-    if (!p->object) return;
-
-    //get block
-    _block *block = &_blocks[*((size_t *)p->object - 1)];
-
-    //do nothing for locked blocks or for already marked blocks
-    if (block->locked || block->mark_phase == _phase) return;
-
-    //mark object
-    block->mark_phase = _phase;
-
-    //mark blocks reachable from pointers of object
-    size_t bp = block->ptrs;
-    while (bp) {
-        _basic_ptr *ptr = (_basic_ptr *)((char *)block->object + bp);
-        _mark(ptr);
-        bp = ptr->index;
+    if (&ptr == this) return;
+    if (root && index == _NO_ROOT_SLOT && weak == ptr.weak) {
+        _heap *prev = _h;
+        _h = _heaps[ptr.heap];
+        bool moved = _move_root(this, &ptr);
+        if (moved) heap = ptr.heap;
+        _h = prev;
+        if (moved) return;
     }
+    operator = ((const _ptr &)ptr);
+    ptr = (Object *)0;
 }
+#endif
 
 
-//adjust a pointer
-static void _adjust(_basic_ptr *p)
+//get the object of a weak pointer; while a marking is in progress, the
+//object is shaded, since the marking may not reach it otherwise and the
+//caller may store it in a strong pointer
+Object *_weak_ptr::get() const
 {
-    //pointer is null
-    if (!p->object) return;
+    _heap *ptr_heap = _heaps[heap];
+    if (!object || !ptr_heap->marking) return object;
+    _heap *prev = _enter(ptr_heap);
+    Object *obj = object;
+    _shade(obj);
+    _leave(prev);
+    return obj;
+}
 
-    //get block
-    _block *block = &_blocks[*((size_t *)p->object - 1)];
 
-    //do nothing for locked blocks
-    if (block->locked) return;
+/*****************************************************************************
+    PUBLIC
+ *****************************************************************************/
 
-    //adjust pointer
-    p->object = block->new_object;
 
-    //adjust pointers of block
-    if (block->adjust_phase == _phase) return;
-    block->adjust_phase = _phase;
-    size_t bp = block->ptrs;
-    while (bp) {
-        _basic_ptr *ptr = (_basic_ptr *)((char *)block->object + bp);
-        _adjust(ptr);
-        bp = ptr->index;
-    }
+//record the object the calling thread allocated last, if its type has a
+//pointer map, so as that its member pointers are constructed without being
+//registered; returns the object
+static inline void *_constructing(void *mem, size_t size, const size_t *map)
+{
+    _mapped_begin = map ? (char *)mem : 0;
+    _mapped_end = map && mem ? (char *)mem + size : 0;
+    _mapped_heap = _h->id;
+    return mem;
 }
 
 
-//collect garbage
-static size_t _collect()
+//allocate an object; the pointers of an object that has a pointer map are
+//at the offsets of the map, else they are registered as they are constructed
+static void *_new(size_t size, bool finalize, const size_t *map)
 {
-    //next phase
-    _phase ^= 1;
-
-    //mark blocks reachable from the root set
-    size_t root_p = _roots[_root_free].prev;
-    while (root_p) {
-        _basic_ptr *ptr = _roots[root_p].ptr;
-        _mark(ptr);
-        root_p = _roots[root_p].prev;
-    }
-
-    //process objects
-    size_t i, new_curr_block = 0, new_alloc_size = 0;
-    _free_index = 0;
-    for(i = 0; i < _curr_block; ++i) {
-        //if block is locked, do nothing
-        if (_blocks[i].locked) {
-            if (!_blocks[i].deleted) {
-                *((size_t *)_blocks[i].object - 1) = new_curr_block;
-                _blocks[new_curr_block] = _blocks[i];
-                new_alloc_size += _blocks[i].size + sizeof(size_t);
-                ++new_curr_block;
-            }
-        }
+    //the first object is allocated before any pointer initializes the library
+    _library library;
 
-        //else if block is marked, calculate new address
-        else if (_blocks[i].mark_phase == _phase) {
-            *((size_t *)_blocks[i].object - 1) = new_curr_block;
-            _blocks[new_curr_block] = _blocks[i];
-            void *mem = _memory + new_alloc_size;
-            _blocks[new_curr_block].new_object = (Object *)((size_t *)mem + 1);
-            new_alloc_size += _blocks[i].size + sizeof(size_t);
-            _free_index += _blocks[i].size + sizeof(size_t);
-            ++new_curr_block;
-        }
+#if GC_MULTITHREADED == 1
+    //an allocation is a safepoint of the registered mutators
+    _safepoint(_h);
 
-        //else delete object
-        else if (!_blocks[i].deleted) {
-            delete _blocks[i].object;
-        }
+    //most objects are allocated from the buffer of the thread, without the lock
+    if (size <= _h->large_object_size && _block_size(size) <= _TLAB_MAX_OBJECT) {
+        void *local = _alloc_local(_block_size(size), finalize, map);
+        if (local) return _constructing(local, size, map);
     }
+#endif
+    lock();
+    void *mem = _alloc(size, finalize, map);
+    size_t pending = _h->finalize_count;
+    unlock();
 
-    //adjust pointers
-    root_p = _roots[_root_free].prev;
-    while (root_p) {
-        _basic_ptr *ptr = _roots[root_p].ptr;
-        _adjust(ptr);
-        root_p = _roots[root_p].prev;
+    //the objects that collections queued are finalized a batch at a time,
+    //after the pauses and without the lock; the batch also pays for the
+    //objects the thread took from its buffer since the last time, so as that
+    //the queue does not grow
+    if (pending) {
+        size_t batch = _FINALIZE_BATCH;
+#if GC_MULTITHREADED == 1
+        if (_thread_tlab && _thread_tlab_serial == _h->serial) batch += _thread_tlab->blocks;
+#endif
+        _run_finalizers(batch);
     }
+    return _constructing(mem, size, map);
+}
 
-    //move marked objects
-    for(i = 0; i < new_curr_block; ++i) {
-        if (!_blocks[i].locked) {
-            *((size_t *)_blocks[i].new_object - 1) = i;
-            memcpy(_blocks[i].new_object, _blocks[i].object, _blocks[i].size);
-            _blocks[i].object = _blocks[i].new_object;
-        }
-    }
 
-    //result is number of freed bytes
-    size_t freed_bytes = _alloc_size - new_alloc_size;
+///allocate object
+void *Object::operator new(size_t size)
+{
+    return _new(size, true, 0);
+}
 
-    //store new statistics for next GC phase
-    _alloc_size = new_alloc_size;
-    _curr_block = new_curr_block;
 
-    return freed_bytes;
+///delete object
+void Object::operator delete(void *p)
+{
+    _heap *prev = _enter(_heap_of(p));
+    _free(p);
+    _leave(prev);
 }
 
 
-//allocate memory
-static void *_alloc(size_t size)
+///allocate object that is not finalized
+void *TrivialObject::operator new(size_t size)
 {
-    //if there are no more blocks free, collect
-    if (_curr_block == _MAX_BLOCKS && !_collect()) return 0;
-
-    //fix size to include header information and be aligned to 8 bytes
-    size = ((size + sizeof(size_t) + 7) >> 3) << 3;
+    return _new(size, false, 0);
+}
 
-    //if there is not enough memory, collect
-    if (_free_index + size > GC_MEMORY_SIZE && !_collect()) return 0;
 
-    //calculate address of allocated memory
-    void *mem = _memory + _free_index;
+///delete object that is not finalized
+void TrivialObject::operator delete(void *p)
+{
+    Object::operator delete(p);
+}
 
-    //allocate memory
-    _free_index += size;
-    _alloc_size += size;
 
-    //register memory block
-    _block *block = &_blocks[_curr_block];
-    block->object = (Object *)((size_t *)mem + 1);
-    block->ptrs = 0;
-    block->size = size - sizeof(size_t);
-    block->mark_phase = _phase;
-    block->adjust_phase = _phase;
-    block->locked = 1;
-    block->deleted = 0;
+///allocate object whose pointers are at the offsets of a map
+void *_new_mapped(size_t size, bool finalize, const size_t *map)
+{
+    return _new(size, finalize, map);
+}
 
-    //link memory block to block entry
-    *(size_t *)mem = _curr_block;
-    ++_curr_block;
 
-    return (size_t *)mem + 1;
+///allocate an array; the items of an array of pointers are constructed
+///without being registered, as the pointers of a mapped object are
+void *_new_array(size_t length, size_t itemSize, bool pointers)
+{
+    if (length > (_MAX_OBJECT_SIZE - sizeof(_array)) / itemSize) return 0;
+    return _new(sizeof(_array) + length * itemSize, false, pointers ? _pointer_items_map : _leaf_map);
 }
 
 
-//free memory block
-static void _free(void *p)
+///allocate a leaf; the finalizer of a leaf that has one is stored in the
+///last word of its object, where the collector finds it
+void *_new_leaf(size_t size, _leaf_finalizer finalizer)
 {
-    _blocks[*((size_t *)p - 1)].deleted = 1;
+    if (!finalizer) return _new(size, false, _leaf_map);
+    size = _block_size(size + sizeof(_leaf_finalizer)) - sizeof(size_t);
+    void *mem = _new(size, true, _leaf_map);
+    if (mem) *(_leaf_finalizer *)((char *)mem + size - sizeof(_leaf_finalizer)) = finalizer;
+    return mem;
 }
 
 
-//unlocks an object
-static void _unlock(void *p)
+///the default configuration
+HeapConfig::HeapConfig()
 {
-    _blocks[*((size_t *)p - 1)].locked = 0;
+    memorySize = GC_MEMORY_SIZE;
+    maxMemorySize = GC_MAX_MEMORY_SIZE;
+    nurserySize = GC_NURSERY_SIZE;
+    largeObjectSize = GC_LARGE_OBJECT_SIZE;
+    largeSpaceSize = GC_LARGE_SPACE_SIZE;
+    maxBlocks = _DEFAULT_MAX_BLOCKS;
+    rootStackSize = _DEFAULT_ROOT_STACK;
+    growthPercent = GC_GROWTH_PERCENT;
+    minTriggerSize = GC_MIN_TRIGGER_SIZE;
+    maxPauseShare = GC_MAX_PAUSE_SHARE;
 }
 
 
-//add root pointer
-static void _add_root_ptr(_basic_ptr *ptr)
+/** The constructor.
+    @param config configuration of the heap.
+ */
+Heap::Heap(const HeapConfig &config)
 {
-    //allocate a node from the already-existing double-linked list of nodes
-    ptr->index = _root_free;
-    _roots[_root_free].ptr = ptr;
-    _root_free = _roots[_root_free].next;
-
-    //if there are no more nodes, link the list of deleted nodes
-    //to the front of the allocated nodes list
-    if (!_root_free) {
-        //if there are no more roots, exit
-        if (!_root_deleted) {
-            fprintf(stderr, "gc: out of root set memory\n");
-            exit(-1);
-        }
+    _heap *prev = _enter(&_default_heap);
+    m_heap = (_heap *)_alloc_table(1, sizeof(_heap));
+    _init_heap(m_heap, config);
+    m_heap->owner = this;
 
-        //link the deleted node right after the node for given pointer
-        _roots[_root_deleted].prev = ptr->index;
-        _roots[ptr->index].next = _root_deleted;
-        _root_free = _root_deleted;
-
-        //no more deleted nodes
-        _root_deleted = 0;
+    //give the heap an id; pointers find their heap by it
+    size_t id;
+    for(id = 1; id < _MAX_HEAPS && _heaps[id]; ++id);
+    if (id == _MAX_HEAPS) {
+        fprintf(stderr, "gc: out of heaps\n");
+        exit(-1);
     }
+    m_heap->id = id;
+    _heaps[id] = m_heap;
+    if (id >= _heap_count) _heap_count = id + 1;
+    _leave(prev);
 }
 
 
-//delete root pointer
-static void _del_root_ptr(_basic_ptr *ptr)
+/** The destructor; it finalizes the objects of the heap.
+ */
+Heap::~Heap()
 {
-    //remove from list of roots
-    _roots[_roots[ptr->index].prev].next = _roots[ptr->index].next;
-    _roots[_roots[ptr->index].next].prev = _roots[ptr->index].prev;
-
-    //insert root node in list of deleted
-    _roots[_root_deleted].prev = ptr->index;
-    _roots[ptr->index].next = _root_deleted;
-    _root_deleted = ptr->index;
+    _free_heap(m_heap);
+    _heap *prev = _enter(&_default_heap);
+    _heaps[m_heap->id] = 0;
+    _leave(prev);
+    free(m_heap);
 }
 
 
-//add pointer
-static void _add_ptr(_basic_ptr *ptr)
+/** Does garbage collection of this heap, and runs the finalizers of the
+    dead objects.
+    @return number of bytes that were freed.
+ */
+size_t Heap::collectGarbage()
 {
-    //if inside the gc memory, then find block that it belongs
-    if (ptr >= (void *)_memory && ptr < (void *)(_memory + GC_MEMORY_SIZE)) {
-
-        //search locked blocks in the reverse order they are created
-        for(int i = _curr_block - 1; i >= 0; --i) {
-
-            //if the pointer is inside the block, then add it in the list of
-            //pointers the block has
-            if (ptr >= (void *)_blocks[i].object &&
-                ptr <  (void *)((char *)_blocks[i].object + _blocks[i].size)) {
-                ptr->index = _blocks[i].ptrs;
-                ptr->root = 0;
-                _blocks[i].ptrs = (char *)ptr - (char *)_blocks[i].object;
-                return;
-            }
-        }
+    _heap *prev = _h;
+    _h = m_heap;
+    size_t freed_bytes = gc::collectGarbage();
+    _h = prev;
+    return freed_bytes;
+}
 
-        //internal error!
-        fprintf(stderr, "gc: internal error: invalid member pointer\n");
-        exit(-1);
-    }
 
-    //otherwise it is a root pointer
-    else {
-        _add_root_ptr(ptr);
-        ptr->root = 1;
-    }
+/** Runs the finalizers of the dead objects that collections of this heap
+    queued.
+    @return number of objects finalized.
+ */
+size_t Heap::runFinalizers()
+{
+    _heap *prev = _h;
+    _h = m_heap;
+    size_t count = gc::runFinalizers();
+    _h = prev;
+    return count;
 }
 
 
-//dynamic initialization
-__library::__library()
+/** Does a bounded step of an incremental garbage collection of this heap.
+    @param budgetMicros time budget of the step in microseconds.
+    @return true if the step finished a collection.
+ */
+bool Heap::collectStep(size_t budgetMicros)
 {
-    //initialize locking
-    initLock();
-
-    //put root pointer entries in a double-linked list
-    _roots[0].prev = 0;
-    _roots[0].next = 1;
-    for(size_t i = 1; i < _MAX_ROOTS - 1; ++i) {
-        _roots[i].prev = i - 1;
-        _roots[i].next = i + 1;
-    }
-    _roots[_MAX_ROOTS - 1].prev = _MAX_ROOTS - 2;
-    _roots[_MAX_ROOTS - 1].next = 0;
+    _heap *prev = _h;
+    _h = m_heap;
+    bool finished = gc::collectStep(budgetMicros);
+    _h = prev;
+    return finished;
 }
 
 
-//clean up
-__library::~__library()
+/** Takes a snapshot of the statistics of this heap.
+    @return the statistics.
+ */
+Stats Heap::getStats()
 {
-    //finalize all blocks
-    lock();
-    for(int i = _curr_block - 1; i >= 0; --i) {
-        if (!_blocks[i].deleted) delete _blocks[i].object;
-    }
-    unlock();
+    _heap *prev = _h;
+    _h = m_heap;
+    Stats stats = gc::getStats();
+    _h = prev;
+    return stats;
+}
 
-    //no more lock
-    deleteLock();
+
+/** Sets the function that is called after each collection of this heap.
+    @param callback the function; null for none.
+    @param data data given to the function.
+ */
+void Heap::setCollectionCallback(CollectionCallback callback, void *data)
+{
+    _heap *prev = _h;
+    _h = m_heap;
+    gc::setCollectionCallback(callback, data);
+    _h = prev;
 }
 
 
-//constructor
-_library::_library()
+/** Binds the calling thread to a heap.
+    @param heap heap to allocate objects in; null for the default heap.
+    @return the heap the thread was bound to; null for the default heap.
+ */
+Heap *Heap::bind(Heap *heap)
 {
-    static __library library;
+    Heap *prev = _h->owner;
+    _h = heap ? heap->m_heap : &_default_heap;
+    return prev;
 }
 
 
-//default constructor
-_ptr::_ptr(Object *obj)
+/** The constructor; it registers the thread with the heap it is bound to.
+ */
+MutatorScope::MutatorScope() : m_stack(0)
 {
-    object = obj;
+#if GC_MULTITHREADED == 1
+    //the heap may be used before any pointer initializes the library
+    _library library;
     lock();
-    if (obj) _unlock(obj);
-    _add_ptr(this);
+    m_stack = _attach_roots();
+    ++m_stack->mutators;
+#if GC_CONSERVATIVE == 1
+    //the stack of the thread is scanned up to its base
+    _find_stack();
+    m_stack->stack_high = _stack_high;
+#endif
+    _thread_mutator = m_stack;
+    _thread_mutator_serial = _h->serial;
     unlock();
+#endif
 }
 
 
-//copy constructor
-_ptr::_ptr(const _ptr &ptr)
+/** The destructor; it unregisters the thread.
+ */
+MutatorScope::~MutatorScope()
 {
-    lock();
-    _add_ptr(this);
-    unlock();
+#if GC_MULTITHREADED == 1
+    _heap *prev = _enter(m_stack->heap);
+    if (!--m_stack->mutators) _thread_mutator = 0;
+    _leave(prev);
+#endif
 }
 
 
-//destructor
-_ptr::~_ptr()
+/** The constructor.
+ */
+SafeRegion::SafeRegion() : m_stack(0), m_safe(0)
 {
-    lock();
-    if (root) _del_root_ptr(this);
-    unlock();
+#if GC_MULTITHREADED == 1
+    m_stack = _thread_mutator;
+    if (!m_stack) return;
+    m_safe = m_stack->safe;
+#if GC_CONSERVATIVE == 1
+    //the frames of the callers, and the registers they hold, are scanned
+    //while the thread is safe
+    SPILL_REGISTERS();
+    if (!m_safe) _save_stack(m_stack);
+#endif
+    atomicStore(&m_stack->safe, 1);
+#endif
 }
 
 
-//assignment from raw pointer
-void _ptr::operator = (Object *obj)
+/** The destructor.
+ */
+SafeRegion::~SafeRegion()
 {
-    if (obj == object) return;
-    object = obj;
-    if (!obj) return;
+#if GC_MULTITHREADED == 1
+    if (!m_stack) return;
+    _heap *prev = _enter(m_stack->heap);
+    m_stack->safe = m_safe;
+    _leave(prev);
+#endif
+}
+
+
+/** Does garbage collection of the heap of the calling thread, and runs the
+    finalizers of the dead objects.
+    @return number of bytes that were freed.
+ */
+size_t collectGarbage()
+{
+    //the heap may be used before any pointer initializes the library
+    _library library;
     lock();
-    _unlock(obj);
+    size_t freed_bytes = _collect();
     unlock();
+
+    //the dead objects that have finalizers are finalized after the pause,
+    //without the lock
+    _run_finalizers((size_t)-1);
+    return freed_bytes;
 }
 
 
-/*****************************************************************************
-    PUBLIC
- *****************************************************************************/
+/** Runs the finalizers of the dead objects that collections of the heap of
+    the calling thread queued.
+    @return number of objects finalized.
+ */
+size_t runFinalizers()
+{
+    //the heap may be used before any pointer initializes the library
+    _library library;
+    return _run_finalizers((size_t)-1);
+}
 
 
-///allocate object
-void *Object::operator new(size_t size)
+/** Does a bounded step of an incremental garbage collection of the heap
+    of the calling thread.
+    @param budgetMicros time budget of the step in microseconds.
+    @return true if the step finished a collection.
+ */
+bool collectStep(size_t budgetMicros)
 {
+    //the heap may be used before any pointer initializes the library
+    _library library;
     lock();
-    void *mem = _alloc(size);
+    size_t start = _begin_pause();
+    size_t deadline = start + budgetMicros;
+    if (!_h->marking) _start_marking(true);
+    bool finished = _drain(deadline);
+    if (finished) _collect();
+    _end_pause(start);
     unlock();
-    return mem;
+    return finished;
 }
 
 
-///delete object
-void Object::operator delete(void *p)
+/** Takes a snapshot of the statistics of the heap of the calling thread.
+    @return the statistics.
+ */
+Stats getStats()
 {
+    //the heap may be used before any pointer initializes the library
+    _library library;
+    size_t i;
     lock();
-    _free(p);
+#if GC_MULTITHREADED == 1
+    //the buffers of the threads are retired, so as that their unused space
+    //is not counted
+    _retire_tlabs();
+#endif
+    Stats stats = _h->stats;
+    stats.memorySize = _h->memory_size;
+    stats.oldBytes = _h->alloc_size;
+    stats.youngBytes = _h->young_size;
+    stats.largeBytes = _h->large_size;
+    stats.triggerBytes = _h->trigger;
+    stats.pendingFinalizers = _h->finalize_count;
+    stats.growthPercent = _h->growth;
+
+    //the objects are the blocks that are not deleted
+    stats.oldObjects = _h->curr_block;
+    for(i = 0; i < _h->curr_block; i += _WORD_BITS) {
+        stats.oldObjects -= bitCount(_scan_word(_h->deletes[i / _WORD_BITS], i, _h->curr_block));
+    }
+    stats.youngObjects = _h->young_count;
+    for(i = 0; i < _h->young_count; i += _WORD_BITS) {
+        stats.youngObjects -= bitCount(_scan_word(_h->young_deletes[i / _WORD_BITS], i, _h->young_count));
+    }
+    stats.largeObjects = _h->large_count;
+    for(i = 0; i < _h->large_count; i += _WORD_BITS) {
+        stats.largeObjects -= bitCount(_scan_word(_h->large_deletes[i / _WORD_BITS], i, _h->large_count));
+    }
+
+    //the roots are counted while the threads do not push or pop them
+    _stop_roots();
+    stats.roots = 0;
+    stats.rootSlots = 0;
+    for(_root_stack *stack = _h->root_stacks; stack; stack = stack->next) {
+        stats.rootSlots += stack->size;
+        for(i = 0; i < stack->top; ++i) {
+            if (stack->slots[i]) ++stats.roots;
+        }
+    }
+    _resume_roots();
     unlock();
+    return stats;
 }
 
 
-/** Does garbage collection.
-    @return number of bytes that were freed.
+/** Sets the function that is called after each collection of the heap of
+    the calling thread.
+    @param callback the function; null for none.
+    @param data data given to the function.
  */
-size_t collectGarbage()
+void setCollectionCallback(CollectionCallback callback, void *data)
 {
+    //the heap may be used before any pointer initializes the library
+    _library library;
     lock();
-    size_t freed_bytes = _collect();
+    _h->callback = callback;
+    _h->callback_data = data;
     unlock();
-    return freed_bytes;
 }
 
 
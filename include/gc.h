@@ -2,6 +2,7 @@
 #define GC_HPP
 
 #include <stddef.h>
+#include <new>
 
 namespace gc {
 
@@ -12,13 +13,129 @@ namespace gc {
 #endif
 
 
-///Memory size in bytes for the garbage collector
+///defined for a thread that marks objects concurrently with the mutators;
+///it requires a multithreaded garbage collector
+#ifndef GC_CONCURRENT
+#define GC_CONCURRENT        0
+#endif
+
+
+///Number of threads that mark and compact objects during a collection; with
+///more than one, the collecting thread works in parallel with helper threads
+#ifndef GC_MARK_THREADS
+#define GC_MARK_THREADS      1
+#endif
+
+
+///defined for collecting the old generation without moving objects: blocks
+///are allocated from pages of size-segregated cells and dead blocks are
+///swept to the free lists of their pages; else the old generation is compacted
+#ifndef GC_MARK_SWEEP
+#define GC_MARK_SWEEP        0
+#endif
+
+
+///Initial memory size in bytes for the garbage collector; the memory grows
+///as needed, up to GC_MAX_MEMORY_SIZE
 #ifndef GC_MEMORY_SIZE
 #define GC_MEMORY_SIZE       (1024 * 1024 * 64)
 #endif //GC_MEMORY_SIZE
 
 
+///Max memory size in bytes for the garbage collector; this much address
+///space is reserved at startup, but memory is used only as the heap grows
+#ifndef GC_MAX_MEMORY_SIZE
+#define GC_MAX_MEMORY_SIZE   ((size_t)1024 * 1024 * (sizeof(void *) > 4 ? 4096 : 512))
+#endif //GC_MAX_MEMORY_SIZE
+
+
+///defined for backing the memory with transparent huge pages, where the
+///system supports them, so as that large heaps take fewer TLB entries
+#ifndef GC_HUGE_PAGES
+#define GC_HUGE_PAGES        0
+#endif
+
+
+///defined for touching the initial memory at startup, so as that the first
+///collections do not pay for page faults
+#ifndef GC_PREFAULT
+#define GC_PREFAULT          0
+#endif
+
+
+///Memory size in bytes for the young generation; new objects are allocated
+///there and the survivors of a minor collection are promoted to the old one
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE      (1024 * 1024 * 4)
+#endif //GC_NURSERY_SIZE
+
+
+///Objects bigger than this many bytes are allocated in the large object
+///space, where they take runs of whole pages and are marked but never moved
+#ifndef GC_LARGE_OBJECT_SIZE
+#define GC_LARGE_OBJECT_SIZE 4096
+#endif //GC_LARGE_OBJECT_SIZE
+
+
+///Address space in bytes reserved for the large object space; its pages are
+///used as they are needed and returned to the system when they are freed
+#ifndef GC_LARGE_SPACE_SIZE
+#define GC_LARGE_SPACE_SIZE  (1024 * 1024 * 256)
+#endif //GC_LARGE_SPACE_SIZE
+
+
+///Growth in percent of the old and large objects between full collections,
+///relative to the bytes that survived the last one: a full collection is
+///done when they grow by this much; with 0, collections are done only when
+///the memory runs out
+#ifndef GC_GROWTH_PERCENT
+#define GC_GROWTH_PERCENT    100
+#endif //GC_GROWTH_PERCENT
+
+
+///Bytes of old and large objects under which no full collection is done
+///for the growth of the heap, so as that small heaps are not collected over
+///and over
+#ifndef GC_MIN_TRIGGER_SIZE
+#define GC_MIN_TRIGGER_SIZE  (1024 * 1024 * 4)
+#endif //GC_MIN_TRIGGER_SIZE
+
+
+///Max share in percent of the time that full collections should take; while
+///they take more, the heap grows more between them
+#ifndef GC_MAX_PAUSE_SHARE
+#define GC_MAX_PAUSE_SHARE   25
+#endif //GC_MAX_PAUSE_SHARE
+
+
+///defined for finding the roots on the stack by scanning it conservatively:
+///pointers on the stack are not registered, and the objects that words of
+///the stack may point into are pinned by the collections, so dead objects
+///that stale words point into are kept too; in a multithreaded collector,
+///only the pointers on the stacks of the registered mutators of a heap are
+///not registered, and a collection scans its own stack and the ones of the
+///mutators it stops, from where they stopped; pointers on the stack of a
+///mutator are destroyed before its MutatorScope
+#ifndef GC_CONSERVATIVE
+#define GC_CONSERVATIVE      0
+#endif
+
+
+///defined if the compiler supports move semantics; pointers are then moved
+///without registering them again
+#ifndef GC_MOVE_SEMANTICS
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define GC_MOVE_SEMANTICS    1
+#else
+#define GC_MOVE_SEMANTICS    0
+#endif
+#endif
+
+
 class Object;
+class Heap;
+struct _heap;
+struct _root_stack;
 
 
 //library
@@ -33,6 +150,8 @@ struct _basic_ptr : _library {
     Object *object;
     size_t index:31;
     size_t root:1;
+    size_t heap:8;
+    size_t weak:1;
 };
 
 
@@ -44,6 +163,11 @@ struct _ptr : _basic_ptr {
     //copy constructor
     _ptr(const _ptr &ptr);
 
+#if GC_MOVE_SEMANTICS == 1
+    //move constructor
+    _ptr(_ptr &&ptr) noexcept;
+#endif
+
     //destructor
     ~_ptr();
 
@@ -51,14 +175,46 @@ struct _ptr : _basic_ptr {
     void operator = (Object *obj);
 
     //assignment from pointer
-    void operator = (const _ptr &ptr) {
-        object = ptr.object;
+    void operator = (const _ptr &ptr);
+
+#if GC_MOVE_SEMANTICS == 1
+    //move assignment
+    void operator = (_ptr &&ptr) noexcept;
+#endif
+
+protected:
+    //constructor of a weak pointer from raw pointer
+    _ptr(Object *obj, bool weak);
+
+    //constructor of a weak pointer from pointer
+    _ptr(const _ptr &ptr, bool weak);
+};
+
+
+//weak pointer
+struct _weak_ptr : _ptr {
+    //default constructor
+    _weak_ptr(Object *obj = 0) : _ptr(obj, true) {
+    }
+
+    //constructor from pointer
+    _weak_ptr(const _ptr &ptr) : _ptr(ptr, true) {
+    }
+
+    //copy constructor
+    _weak_ptr(const _weak_ptr &ptr) : _ptr(ptr, true) {
     }
+
+    //get the object; it is marked while a marking is in progress
+    Object *get() const;
 };
 
 
 /** Base class for all garbage collected objects.
-    It must be the first class in the inheritance tree.
+    It must be the first class in the inheritance tree. Dead objects are
+    finalized after the pause of the collection that finds them, at the
+    next allocation or by runFinalizers; the objects they point to are kept
+    until then, and their memory is reclaimed by the next collection.
  */
 class Object : _library {
 public:
@@ -85,11 +241,86 @@ private:
 };
 
 
+/** Base class for garbage collected objects that need no finalization.
+    Dead objects of derived classes are freed without calling their
+    destructor, so it must do nothing but destroy garbage-collected pointers.
+ */
+class TrivialObject : public Object {
+public:
+    /** allocates a garbage-collected object that is not finalized.
+        @param size size of object in bytes.
+        @return pointer to allocated memory or null if out of memory.
+     */
+    void *operator new(size_t size);
+
+    /** deletes a garbage-collected object.
+        @param p pointer to object to free.
+     */
+    void operator delete(void *p);
+};
+
+
+//allocate an object whose pointers are at the offsets of a map
+void *_new_mapped(size_t size, bool finalize, const size_t *map);
+
+
+//checks if objects of a class are finalized, by its base
+inline bool _finalized(const Object *) { return true; }
+inline bool _finalized(const TrivialObject *) { return false; }
+
+
+/** Offset of a pointer member of a class, for the pointer map of the class.
+    The member is addressed in an object at a fake address, as offsetof
+    does; offsetof itself is not meant for classes that have virtual
+    functions.
+    @param member pointer to the member.
+    @return offset of the member in bytes.
+ */
+template <class T, class M> size_t pointerOffset(M T::*member) {
+    return (size_t)&(((T *)sizeof(T))->*member) - sizeof(T);
+}
+
+
+/** Base class for garbage collected objects whose pointers are found by a
+    map of their offsets, which is shared by all objects of the class,
+    instead of being registered one by one as they are constructed. The
+    collector walks the map instead of a chain through the pointers, and
+    null pointer members are constructed without taking the lock.
+    The class must have a static function pointerMap() that returns the
+    offsets of all its Pointer and WeakPointer members, the ones of its
+    bases included, terminated by 0; pointerOffset gives them. An object
+    of a derived class is allocated without the map, unless the derived
+    class is a MappedObject with its own map.
+    @param T the derived class.
+    @param Base base class; Object, TrivialObject, or a class derived from
+        them.
+ */
+template <class T, class Base = Object> class MappedObject : public Base {
+public:
+    /** allocates a garbage-collected object.
+        @param size size of object in bytes.
+        @return pointer to allocated memory or null if out of memory.
+     */
+    void *operator new(size_t size) {
+        return _new_mapped(size, _finalized((Base *)0), size == sizeof(T) ? T::pointerMap() : 0);
+    }
+
+    /** deletes a garbage-collected object.
+        @param p pointer to object to free.
+     */
+    void operator delete(void *p) {
+        Base::operator delete(p);
+    }
+};
+
+
 /** A garbage-collected pointer.
     @param T type of garbage-collected object; it must be derived from class
         Object.
  */
 template <class T> class Pointer : _ptr {
+    template <class U> friend class WeakPointer;
+
 public:
     /** The default constructor.
         @param p pointer to object.
@@ -103,6 +334,15 @@ public:
     Pointer(const Pointer<T> &p) : _ptr(p) {
     }
 
+#if GC_MOVE_SEMANTICS == 1
+    /** The move constructor; a root pointer takes over the registration of
+        the given one, if it can.
+        @param p source object; it is null afterwards.
+     */
+    Pointer(Pointer<T> &&p) noexcept : _ptr(static_cast<_ptr &&>(p)) {
+    }
+#endif
+
     /** Retrieves the pointer value.
         @return a raw pointer to object of type T; it may be null.
      */
@@ -173,15 +413,773 @@ public:
         _ptr::operator = (p);
         return *this;
     }
+
+#if GC_MOVE_SEMANTICS == 1
+    /** move assignment from pointer object.
+        @param p pointer; it is null afterwards.
+        @return reference to this.
+     */
+    Pointer<T> &operator = (Pointer<T> &&p) noexcept {
+        _ptr::operator = (static_cast<_ptr &&>(p));
+        return *this;
+    }
+#endif
 };
 
 
-/** Does garbage collection.
-    @return number of bytes that were freed.
+/** A weak garbage-collected pointer.
+    It does not keep its object alive: when the object is no longer
+    reachable through other pointers, a collection clears the pointer
+    before the object is queued for finalization; else the pointer follows
+    the object when it moves. Caches can drop their cleared entries from the
+    collection callback, which reports how many pointers were cleared.
+    @param T type of garbage-collected object; it must be derived from class
+        Object.
+ */
+template <class T> class WeakPointer : _weak_ptr {
+public:
+    /** The default constructor.
+        @param p pointer to object.
+     */
+    WeakPointer(T *p = 0) : _weak_ptr(p) {
+    }
+
+    /** The constructor from a pointer.
+        @param p pointer to object.
+     */
+    WeakPointer(const Pointer<T> &p) : _weak_ptr(static_cast<const _ptr &>(p)) {
+    }
+
+    /** The copy constructor.
+        @param p source object.
+     */
+    WeakPointer(const WeakPointer<T> &p) : _weak_ptr(p) {
+    }
+
+    /** Retrieves the pointer value; a Pointer that is assigned it keeps the
+        object alive.
+        @return a raw pointer to object of type T; it is null if the object
+            was collected.
+     */
+    T *get() const {
+        return (T *)_weak_ptr::get();
+    }
+
+    /** Retrieves the pointer value, as get does.
+        @return a raw pointer to object of type T; it is null if the object
+            was collected.
+     */
+    T *operator ()() const {
+        return get();
+    }
+
+    /** Automatic conversion to raw pointer.
+        @return a raw pointer to object of type T; it is null if the object
+            was collected.
+     */
+    operator T *() const {
+        return get();
+    }
+
+    /** Access to the pointed object's members.
+        @return a raw pointer to object of type T; it is null if the object
+            was collected.
+     */
+    T *operator ->() const {
+        return get();
+    }
+
+    /** Checks if the object was collected.
+        @return true if the pointer was cleared or it is null.
+     */
+    bool expired() const {
+        return object == 0;
+    }
+
+    /** The equal-to comparison operator with pointer.
+        @param p pointer to compare to this.
+        @return true if this and given object point to the same object.
+     */
+    bool operator == (const T *p) const {
+        return object == p;
+    }
+
+    /** The different-than comparison operator with pointer.
+        @param p pointer to compare to this.
+        @return true if this and given object point to different objects.
+     */
+    bool operator != (const T *p) const {
+        return object != p;
+    }
+
+    /** assignment from raw pointer.
+        @param p raw pointer.
+        @return reference to this.
+     */
+    WeakPointer<T> &operator = (T *p) {
+        _ptr::operator = (p);
+        return *this;
+    }
+
+    /** assignment from pointer object.
+        @param p pointer.
+        @return reference to this.
+     */
+    WeakPointer<T> &operator = (const Pointer<T> &p) {
+        _ptr::operator = (static_cast<const _ptr &>(p));
+        return *this;
+    }
+
+    /** assignment from weak pointer object.
+        @param p weak pointer.
+        @return reference to this.
+     */
+    WeakPointer<T> &operator = (const WeakPointer<T> &p) {
+        _ptr::operator = (p);
+        return *this;
+    }
+};
+
+
+//header of an array; the items follow it
+class _array : public TrivialObject {
+public:
+    size_t m_length;
+
+    //constructor
+    _array(size_t length) : m_length(length) {
+    }
+};
+
+
+//allocate an array; the items of an array of pointers are its pointers
+void *_new_array(size_t length, size_t itemSize, bool pointers);
+
+
+/** A garbage-collected array of items that hold no garbage-collected
+    pointers.
+    The items follow the header in the same object, and the collector never
+    scans them. The items are not destroyed, so their destructor must do
+    nothing; they are aligned to 8 bytes.
+    @param T type of item.
+ */
+template <class T> class Array : public _array {
+public:
+    /** allocates an array; its items are value-initialized.
+        @param length number of items.
+        @return the array or null if out of memory.
+     */
+    static Array<T> *create(size_t length) {
+        void *mem = _new_array(length, sizeof(T), false);
+        return mem ? ::new (mem) Array<T>(length) : 0;
+    }
+
+    /** Returns the number of items.
+        @return the number of items.
+     */
+    size_t length() const {
+        return m_length;
+    }
+
+    /** Returns the items.
+        @return pointer to the first item.
+     */
+    T *items() {
+        return (T *)(this + 1);
+    }
+
+    /** Returns the items.
+        @return pointer to the first item.
+     */
+    const T *items() const {
+        return (const T *)(this + 1);
+    }
+
+    /** Access to an item.
+        @param i index of the item.
+        @return reference to the item.
+     */
+    T &operator [](size_t i) {
+        return items()[i];
+    }
+
+    /** Access to an item.
+        @param i index of the item.
+        @return reference to the item.
+     */
+    const T &operator [](size_t i) const {
+        return items()[i];
+    }
+
+private:
+    //constructor
+    Array(size_t length) : _array(length) {
+        for (size_t i = 0; i < length; ++i) ::new (items() + i) T();
+    }
+
+    ///arrays can not be copied
+    Array(const Array<T> &);
+    void operator = (const Array<T> &);
+};
+
+
+/** A garbage-collected array of pointers.
+    The pointers follow the header in the same object, and the collector
+    scans them as one range instead of registering them one by one; they
+    are null at first.
+    @param T type of garbage-collected object; it must be derived from class
+        Object.
+ */
+template <class T> class PointerArray : public _array {
+public:
+    /** allocates an array of null pointers.
+        @param length number of pointers.
+        @return the array or null if out of memory.
+     */
+    static PointerArray<T> *create(size_t length) {
+        void *mem = _new_array(length, sizeof(Pointer<T>), true);
+        return mem ? ::new (mem) PointerArray<T>(length) : 0;
+    }
+
+    /** Returns the number of pointers.
+        @return the number of pointers.
+     */
+    size_t length() const {
+        return m_length;
+    }
+
+    /** Returns the pointers.
+        @return the first pointer.
+     */
+    Pointer<T> *items() {
+        return (Pointer<T> *)(this + 1);
+    }
+
+    /** Returns the pointers.
+        @return the first pointer.
+     */
+    const Pointer<T> *items() const {
+        return (const Pointer<T> *)(this + 1);
+    }
+
+    /** Access to a pointer.
+        @param i index of the pointer.
+        @return reference to the pointer.
+     */
+    Pointer<T> &operator [](size_t i) {
+        return items()[i];
+    }
+
+    /** Access to a pointer.
+        @param i index of the pointer.
+        @return reference to the pointer.
+     */
+    const Pointer<T> &operator [](size_t i) const {
+        return items()[i];
+    }
+
+private:
+    //constructor
+    PointerArray(size_t length) : _array(length) {
+        for (size_t i = 0; i < length; ++i) ::new (items() + i) Pointer<T>();
+    }
+
+    ///arrays can not be copied
+    PointerArray(const PointerArray<T> &);
+    void operator = (const PointerArray<T> &);
+};
+
+
+//finalizer of a leaf
+typedef void (*_leaf_finalizer)(void *);
+
+
+//allocate a leaf; it is finalized by the given function, if any
+void *_new_leaf(size_t size, _leaf_finalizer finalizer);
+
+
+//destroy a leaf of type T
+template <class T> void _destroy_leaf(void *p) {
+    ((T *)p)->~T();
+}
+
+
+/** Allocates a garbage-collected leaf: memory that holds no garbage-collected
+    pointers, such as the bytes of a string or a numeric buffer. The
+    collector never scans it; it is moved and reclaimed as the other
+    objects are. Leaves are pointed to by LeafPointer.
+    @param size size of the leaf in bytes.
+    @return pointer to the leaf or null if out of memory.
+ */
+inline void *allocateLeaf(size_t size) {
+    return _new_leaf(size, 0);
+}
+
+
+/** Allocates a garbage-collected leaf object. Its type need not derive from
+    Object, nor have virtual functions, but it must not hold
+    garbage-collected pointers.
+    @param T type of object.
+    @param finalize true if the destructor of the object runs when it dies,
+        as the one of an Object does; else the object is reclaimed without
+        it.
+    @return the value-initialized object or null if out of memory.
+ */
+template <class T> T *newLeaf(bool finalize = false) {
+    void *mem = _new_leaf(sizeof(T), finalize ? &_destroy_leaf<T> : 0);
+    return mem ? ::new (mem) T() : 0;
+}
+
+
+/** A garbage-collected pointer to a leaf.
+    @param T type of leaf; it is allocated by newLeaf, or by allocateLeaf.
+ */
+template <class T> class LeafPointer : _ptr {
+public:
+    /** The default constructor.
+        @param p pointer to leaf.
+     */
+    LeafPointer(T *p = 0) : _ptr((Object *)p) {
+    }
+
+    /** The copy constructor.
+        @param p source object.
+     */
+    LeafPointer(const LeafPointer<T> &p) : _ptr(p) {
+    }
+
+#if GC_MOVE_SEMANTICS == 1
+    /** The move constructor.
+        @param p source object; it is null afterwards.
+     */
+    LeafPointer(LeafPointer<T> &&p) noexcept : _ptr(static_cast<_ptr &&>(p)) {
+    }
+#endif
+
+    /** Retrieves the pointer value.
+        @return a raw pointer to leaf of type T; it may be null.
+     */
+    T *operator ()() const {
+        return (T *)object;
+    }
+
+    /** Automatic conversion to raw pointer.
+        @return a raw pointer to leaf of type T; it may be null.
+     */
+    operator T *() const {
+        return (T *)object;
+    }
+
+    /** Access to the pointed leaf's members.
+        @return a raw pointer to leaf of type T; it may be null.
+     */
+    T *operator ->() const {
+        return (T *)object;
+    }
+
+    /** The equal-to comparison operator with pointer.
+        @param p pointer to compare to this.
+        @return true if this and given pointer point to the same leaf.
+     */
+    bool operator == (const T *p) const {
+        return (const T *)object == p;
+    }
+
+    /** The different-than comparison operator with pointer.
+        @param p pointer to compare to this.
+        @return true if this and given pointer point to different leaves.
+     */
+    bool operator != (const T *p) const {
+        return (const T *)object != p;
+    }
+
+    /** assignment from raw pointer.
+        @param p raw pointer.
+        @return reference to this.
+     */
+    LeafPointer<T> &operator = (T *p) {
+        _ptr::operator = ((Object *)p);
+        return *this;
+    }
+
+    /** assignment from pointer object.
+        @param p pointer.
+        @return reference to this.
+     */
+    LeafPointer<T> &operator = (const LeafPointer<T> &p) {
+        _ptr::operator = (p);
+        return *this;
+    }
+
+#if GC_MOVE_SEMANTICS == 1
+    /** move assignment from pointer object.
+        @param p pointer; it is null afterwards.
+        @return reference to this.
+     */
+    LeafPointer<T> &operator = (LeafPointer<T> &&p) noexcept {
+        _ptr::operator = (static_cast<_ptr &&>(p));
+        return *this;
+    }
+#endif
+};
+
+
+/** Runtime configuration of a heap.
+    The default values are the compile-time ones.
+ */
+struct HeapConfig {
+    ///initial memory size in bytes of the old generation
+    size_t memorySize;
+
+    ///max memory size in bytes of the old generation
+    size_t maxMemorySize;
+
+    ///memory size in bytes of the young generation
+    size_t nurserySize;
+
+    ///objects bigger than this many bytes go to the large object space
+    size_t largeObjectSize;
+
+    ///address space in bytes reserved for the large object space
+    size_t largeSpaceSize;
+
+    ///max objects of the old generation
+    size_t maxBlocks;
+
+    ///initial root pointers of the root stack of a thread; stacks grow as
+    ///they need to
+    size_t rootStackSize;
+
+    ///growth in percent of the old and large objects that triggers a full
+    ///collection; 0 for none
+    size_t growthPercent;
+
+    ///bytes of old and large objects under which no full collection is
+    ///triggered by their growth
+    size_t minTriggerSize;
+
+    ///max share in percent of the time that full collections should take
+    size_t maxPauseShare;
+
+    /** the default constructor.
+     */
+    HeapConfig();
+};
+
+
+/** Record of a collection.
+    Times are in microseconds. A collection of the young generation times
+    only its marking, which promotes the survivors, and its finalization.
+ */
+struct CollectionStats {
+    ///true for a collection of both generations
+    bool full;
+
+    ///bytes that were freed
+    size_t freedBytes;
+
+    ///bytes used by objects after the collection
+    size_t liveBytes;
+
+    ///time the collection took
+    size_t pauseMicros;
+
+    ///time spent marking the live objects and the dead ones that are queued
+    ///for finalization; it includes the collection of the young generation
+    ///that a full collection does first
+    size_t markMicros;
+
+    ///time spent planning the new addresses of the old objects, or sweeping
+    ///them
+    size_t planMicros;
+
+    ///time spent freeing the dead young and large objects; their finalizers
+    ///run after the collection
+    size_t finalizeMicros;
+
+    ///time spent adjusting the pointers to the objects that move
+    size_t adjustMicros;
+
+    ///time spent moving objects
+    size_t moveMicros;
+
+    ///weak pointers that were cleared; it includes the ones of the
+    ///collection of the young generation that a full collection does first
+    size_t clearedWeakPointers;
+};
+
+
+/** Statistics of a heap.
+    The counters are cumulative since the heap was created; the sizes are
+    the ones at the time of the snapshot.
+ */
+struct Stats {
+    ///buckets of the pause histogram
+    enum { PAUSE_BUCKETS = 24 };
+
+    ///memory size in bytes of the old generation
+    size_t memorySize;
+
+    ///bytes used by objects of the old generation
+    size_t oldBytes;
+
+    ///bytes used by objects of the young generation
+    size_t youngBytes;
+
+    ///bytes of the pages of the large object space that are used
+    size_t largeBytes;
+
+    ///objects of the old generation
+    size_t oldObjects;
+
+    ///objects of the young generation
+    size_t youngObjects;
+
+    ///objects of the large object space
+    size_t largeObjects;
+
+    ///root pointers
+    size_t roots;
+
+    ///slots of the root stacks of the threads; the slots that roots which
+    ///were destroyed out of order leave are reused
+    size_t rootSlots;
+
+    ///dead objects that are queued for finalization
+    size_t pendingFinalizers;
+
+    ///bytes of old and large objects at which the next full collection is
+    ///done
+    size_t triggerBytes;
+
+    ///growth in percent that set the trigger; it is more than the configured
+    ///one while full collections take more than their share of the time
+    size_t growthPercent;
+
+    ///collections of both generations
+    size_t collections;
+
+    ///collections of the young generation only
+    size_t minorCollections;
+
+    ///bytes freed by all collections
+    size_t freedBytes;
+
+    ///weak pointers cleared by all collections
+    size_t clearedWeakPointers;
+
+    ///pauses of the threads that collect, either whole collections or steps
+    ///of an incremental one
+    size_t pauses;
+
+    ///total time of the pauses in microseconds
+    size_t pauseMicros;
+
+    ///longest pause in microseconds
+    size_t maxPauseMicros;
+
+    ///bucket i counts the pauses shorter than 2^i microseconds and not
+    ///shorter than 2^(i-1); the last bucket counts the longer ones too
+    size_t pauseHistogram[PAUSE_BUCKETS];
+
+    ///the last collection
+    CollectionStats last;
+};
+
+
+/** Function that is called after each collection.
+    It is called with the heap locked, and it must not allocate objects in
+    it. A collection of the young generation that a full collection does
+    first is not reported by itself.
+    @param stats record of the collection.
+    @param data data given along with the function.
+ */
+typedef void (*CollectionCallback)(const CollectionStats &stats, void *data);
+
+
+/** A garbage-collected heap, independent of the others.
+    Each heap has its own memory, root set and lock, and it is collected
+    without stopping the threads that work on other heaps. Objects are
+    allocated in the heap the calling thread is bound to; threads are bound
+    to the default heap at first. A root pointer belongs to the heap of the
+    object it points to, whichever heap the thread is bound to. An object
+    of a heap must not point to objects of another heap, and all the
+    pointers to objects of a heap must be destroyed before the heap.
+ */
+class Heap : _library {
+public:
+    /** The constructor.
+        @param config configuration of the heap.
+     */
+    Heap(const HeapConfig &config = HeapConfig());
+
+    /** The destructor; it finalizes the objects of the heap.
+     */
+    ~Heap();
+
+    /** Does garbage collection of this heap, and runs the finalizers of
+        the dead objects.
+        @return number of bytes that were freed.
+     */
+    size_t collectGarbage();
+
+    /** Runs the finalizers of the dead objects that collections of this
+        heap queued.
+        @return number of objects finalized.
+     */
+    size_t runFinalizers();
+
+    /** Does a bounded step of an incremental garbage collection of this
+        heap.
+        @param budgetMicros time budget of the step in microseconds.
+        @return true if the step finished a collection.
+     */
+    bool collectStep(size_t budgetMicros);
+
+    /** Takes a snapshot of the statistics of this heap.
+        @return the statistics.
+     */
+    Stats getStats();
+
+    /** Sets the function that is called after each collection of this heap.
+        @param callback the function; null for none.
+        @param data data given to the function.
+     */
+    void setCollectionCallback(CollectionCallback callback, void *data = 0);
+
+    /** Binds the calling thread to a heap.
+        @param heap heap to allocate objects in; null for the default heap.
+        @return the heap the thread was bound to; null for the default heap.
+     */
+    static Heap *bind(Heap *heap);
+
+private:
+    _heap *m_heap;
+
+    ///heaps can not be copied
+    Heap(const Heap &);
+    void operator = (const Heap &);
+};
+
+
+/** Binds the calling thread to a heap for the lifetime of this object.
+ */
+class HeapScope {
+public:
+    /** The constructor.
+        @param heap heap to allocate objects in.
+     */
+    HeapScope(Heap &heap) : m_prev(Heap::bind(&heap)) {
+    }
+
+    /** The destructor; it binds the thread to its previous heap.
+     */
+    ~HeapScope() {
+        Heap::bind(m_prev);
+    }
+
+private:
+    Heap *m_prev;
+};
+
+
+/** Registers the calling thread as a mutator of its heap while it exists.
+    A collection of the heap stops the registered threads before it moves
+    objects: each one stops at its next safepoint, that is, an allocation
+    or a pointer assignment, or while it waits for the heap. Between
+    safepoints, a registered thread may hold raw pointers to objects.
+    A registered thread that blocks or computes for long does so in a
+    SafeRegion, otherwise the collections wait for it. A thread is a mutator
+    of one heap at a time, and the scope ends before the heap is deleted.
+    In a collector that is not multithreaded, it does nothing.
+ */
+class MutatorScope {
+public:
+    /** The constructor; it registers the thread with the heap it is bound to.
+     */
+    MutatorScope();
+
+    /** The destructor; it unregisters the thread.
+     */
+    ~MutatorScope();
+
+private:
+    _root_stack *m_stack;
+
+    ///scopes can not be copied
+    MutatorScope(const MutatorScope &);
+    void operator = (const MutatorScope &);
+};
+
+
+/** Lets the collections run without the calling thread while it exists,
+    if it is a registered mutator; the thread must not use objects or
+    pointers meanwhile. The destructor waits for a collection in progress.
+    If the collector is conservative, the collections scan the stack of the
+    thread above the region, where its pointers are, and where its registers
+    are spilled when the region starts.
+ */
+class SafeRegion {
+public:
+    /** The constructor.
+     */
+    SafeRegion();
+
+    /** The destructor.
+     */
+    ~SafeRegion();
+
+private:
+    _root_stack *m_stack;
+    size_t m_safe;
+
+    ///regions can not be copied
+    SafeRegion(const SafeRegion &);
+    void operator = (const SafeRegion &);
+};
+
+
+/** Does garbage collection of the heap of the calling thread, and runs the
+    finalizers of the dead objects.
+    @return number of bytes that were freed; the memory of the objects that
+        are finalized is reclaimed by the next collection.
  */
 size_t collectGarbage();
 
 
+/** Runs the finalizers of the dead objects that collections of the heap of
+    the calling thread queued.
+    @return number of objects finalized.
+ */
+size_t runFinalizers();
+
+
+/** Does a bounded step of an incremental garbage collection of the heap
+    of the calling thread.
+    The first step starts a new collection; each step then marks objects
+    until the budget is exhausted, and the step that completes the marking
+    does a short final remark and compacts the heap. Pointer assignments
+    between steps are tracked by a write barrier.
+    @param budgetMicros time budget of the step in microseconds.
+    @return true if the step finished a collection.
+ */
+bool collectStep(size_t budgetMicros);
+
+
+/** Takes a snapshot of the statistics of the heap of the calling thread.
+    @return the statistics.
+ */
+Stats getStats();
+
+
+/** Sets the function that is called after each collection of the heap of
+    the calling thread.
+    @param callback the function; null for none.
+    @param data data given to the function.
+ */
+void setCollectionCallback(CollectionCallback callback, void *data = 0);
+
+
 } //end of namespace
 
 
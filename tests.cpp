@@ -0,0 +1,1275 @@
+#include "gc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#if GC_MULTITHREADED == 1
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+
+/*****************************************************************************
+    TESTS
+
+    Each test checks one feature of the collector, in a heap of its own
+    that is bound to the thread while the test runs; the collections it
+    forces do not depend on the tests before it. Failed checks are printed
+    along with their line, and the exit code is the number of tests that
+    failed.
+
+    usage: tests [test...]
+ *****************************************************************************/
+
+
+using namespace gc;
+
+
+//nursery of the heaps of the tests; it is small, so as that a few thousand
+//objects fill it
+#define TEST_NURSERY_SIZE    (256 * 1024)
+
+
+//objects allocated by churn(); enough for a few minor collections
+#define CHURN_OBJECTS        20000
+
+
+//failed checks of the running test
+static int failures = 0;
+
+
+//check a condition of a test
+#define CHECK(COND)          check((COND), #COND, __LINE__)
+
+
+//count a failed check
+static void check(bool ok, const char *cond, int line)
+{
+    if (ok) return;
+    fprintf(stderr, "  line %d: %s\n", line, cond);
+    ++failures;
+}
+
+
+//functions that make the objects that are to die are not inlined, so as
+//that the frames of the tests do not point to them
+#ifdef __GNUC__
+#define NOINLINE             __attribute__((noinline))
+#else
+#define NOINLINE             __declspec(noinline)
+#endif
+
+
+//objects finalized since the test started
+static int finalized = 0;
+
+
+//finalized object
+struct Node : Object {
+    Pointer<Node> next;
+    int value;
+
+    Node(int v = 0) : value(v) {
+    }
+
+    ~Node() {
+        ++finalized;
+    }
+};
+
+
+//object without finalization
+struct Cell : TrivialObject {
+    Pointer<Cell> next;
+    int value;
+
+    Cell(int v = 0) : value(v) {
+    }
+};
+
+
+//allocate garbage until the young generation was collected a few times
+static void churn()
+{
+    for(int i = 0; i < CHURN_OBJECTS; ++i) {
+        Pointer<Cell> garbage = new Cell(-1);
+    }
+}
+
+
+//list of cells whose values count down from count - 1 to 0
+static Pointer<Cell> cells(int count)
+{
+    Pointer<Cell> head;
+    for(int i = 0; i < count; ++i) {
+        Pointer<Cell> cell = new Cell(i);
+        cell->next = head;
+        head = cell;
+    }
+    return head;
+}
+
+
+//checks a list made by cells()
+static bool intact(Cell *cell, int count)
+{
+    for(; cell; cell = cell->next) {
+        if (cell->value != --count) return false;
+    }
+    return count == 0;
+}
+
+
+//clear the stack below the caller, where the frames of the functions it
+//called left words that point to dead objects; a conservative collection
+//would keep them
+static NOINLINE void scrub()
+{
+    volatile char frames[64 * 1024];
+    for(size_t i = 0; i < sizeof(frames); ++i) frames[i] = 0;
+}
+
+
+/*****************************************************************************
+    GENERATIONS
+ *****************************************************************************/
+
+
+//young objects that are reachable survive the minor collections, which
+//promote them
+static void test_young()
+{
+    Pointer<Cell> list = cells(1000);
+    size_t minor = getStats().minorCollections;
+    churn();
+    CHECK(getStats().minorCollections > minor);
+    CHECK(intact(list, 1000));
+}
+
+
+/*****************************************************************************
+    MARKING
+ *****************************************************************************/
+
+
+//a marking done in steps keeps the objects that are stored into scanned
+//objects meanwhile
+static void test_incremental()
+{
+    Pointer<Cell> list = cells(5000);
+    Pointer<Cell> holder = new Cell(0);
+    Pointer<Cell> moved = new Cell(42);
+    collectGarbage();
+    size_t collections = getStats().collections;
+    CHECK(!collectStep(0));
+    holder->next = moved;
+    moved = 0;
+    while (!collectStep(1000));
+    CHECK(getStats().collections == collections + 1);
+    CHECK(holder->next && holder->next->value == 42);
+    CHECK(intact(list, 5000));
+}
+
+
+//object that is deleted explicitly
+struct Holder : Object {
+    Pointer<Cell> cell;
+};
+
+
+//roots of test_delete_marking(), made in the order that has the marking
+//scan the deleted object last; they are not on the stack, since the objects
+//that a conservative scan pins stay young
+struct MarkingRoots {
+    Pointer<Holder> holder;
+    Pointer<Cell> many[1000];
+    Pointer<Cell> scanned;
+};
+
+
+//make the roots of test_delete_marking()
+static NOINLINE MarkingRoots *marking_roots()
+{
+    MarkingRoots *roots = new MarkingRoots;
+    roots->holder = new Holder;
+    roots->holder->cell = new Cell(42);
+    for(int i = 0; i < 1000; ++i) roots->many[i] = new Cell(i);
+    roots->scanned = new Cell(0);
+    return roots;
+}
+
+
+//an object that is deleted while a marking is in progress does not hide
+//the objects it pointed to from the marking
+static void test_delete_marking()
+{
+    MarkingRoots *roots = marking_roots();
+    scrub();
+    churn();
+    collectGarbage();
+    CHECK(!collectStep(0));
+    roots->scanned->next = roots->holder->cell;
+    Holder *deleted = roots->holder;
+    roots->holder = 0;
+    delete deleted;
+    while (!collectStep(1000));
+    Pointer<Cell> promoted = cells(1000);
+    churn();
+    collectGarbage();
+    CHECK(roots->scanned->next && roots->scanned->next->value == 42);
+    bool kept = true;
+    for(int i = 0; i < 1000; ++i) kept = kept && roots->many[i]->value == i;
+    CHECK(kept && intact(promoted, 1000));
+    delete roots;
+}
+
+
+//an object that no pointer holds yet stays in place, and keeps the objects
+//it points to, until a pointer takes it
+static void test_locked()
+{
+    Holder *raw = new Holder;
+    raw->cell = new Cell(42);
+    churn();
+    collectGarbage();
+    CHECK(raw->cell && raw->cell->value == 42);
+    Pointer<Holder> holder = raw;
+    collectGarbage();
+    CHECK(holder->cell && holder->cell->value == 42);
+}
+
+
+//binary tree
+struct Tree : Object {
+    Pointer<Tree> left, right;
+    int depth;
+};
+
+
+//complete binary tree of a depth
+static Pointer<Tree> tree(int depth)
+{
+    Pointer<Tree> node = new Tree;
+    node->depth = depth;
+    if (depth) {
+        node->left = tree(depth - 1);
+        node->right = tree(depth - 1);
+    }
+    return node;
+}
+
+
+//checks a tree made by tree()
+static bool complete(Tree *node, int depth)
+{
+    if (!node || node->depth != depth) return false;
+    if (!depth) return !node->left && !node->right;
+    return complete(node->left, depth - 1) && complete(node->right, depth - 1);
+}
+
+
+//a marking reaches all of a wide graph, whose branches the mark threads
+//share
+static void test_tree()
+{
+    Pointer<Tree> root = tree(16);
+    churn();
+    collectGarbage();
+    collectGarbage();
+    CHECK(complete(root, 16));
+}
+
+
+//the marking and the adjustment of the pointers reach the end of a long
+//list
+static void test_deep()
+{
+    Pointer<Cell> list = cells(200000);
+    collectGarbage();
+    collectGarbage();
+    CHECK(intact(list, 200000));
+}
+
+
+//object with member pointers at both ends of a payload of a size; its
+//constructor allocates the objects they point to
+template <int N> struct Padded : Object {
+    Pointer<Cell> first;
+    char payload[N];
+    Pointer<Cell> last;
+
+    Padded() {
+        first = new Cell(1);
+        last = new Cell(2);
+    }
+
+    bool intact() const {
+        return first && first->value == 1 && last && last->value == 2;
+    }
+};
+
+
+//the member pointers of objects of all sizes are found, even when objects
+//are allocated while they are constructed
+static void test_members()
+{
+    Pointer<Padded<8> > small = new Padded<8>;
+    Pointer<Padded<1000> > medium = new Padded<1000>;
+    Pointer<Padded<3000> > big = new Padded<3000>;
+    Pointer<Padded<10000> > large = new Padded<10000>;
+    churn();
+    collectGarbage();
+    collectGarbage();
+    CHECK(small->intact() && medium->intact());
+    CHECK(big->intact() && large->intact());
+}
+
+
+/*****************************************************************************
+    FINALIZATION
+ *****************************************************************************/
+
+
+//finalized object whose finalizer collects when it is the fourth one to run
+struct Collector : Object {
+    char payload[256];
+
+    ~Collector() {
+        if (++finalized == 4) collectGarbage();
+    }
+};
+
+
+//allocate collectors that are promoted and then die
+static NOINLINE void allocate_dead_collectors()
+{
+    Pointer<Collector> collectors[32];
+    for(int i = 0; i < 32; ++i) collectors[i] = new Collector;
+    collectGarbage();
+}
+
+
+//a finalizer that collects does not reclaim or move the objects whose
+//finalizers run in the same batch, and the objects that the ones before it
+//freed are reclaimed
+static void test_finalizer_collects()
+{
+    allocate_dead_collectors();
+    scrub();
+    Pointer<Cell> list = cells(1000);
+    collectGarbage();
+    collectGarbage();
+    runFinalizers();
+    CHECK(finalized == 32);
+    CHECK(intact(list, 1000));
+}
+
+
+//finalized objects when a collection was reported
+static int finalized_at_report = -1;
+
+
+//records the finalized objects when the first collection is reported
+static void report_finalized(const CollectionStats &, void *)
+{
+    if (finalized_at_report < 0) finalized_at_report = finalized;
+}
+
+
+//allocate nodes that die at once
+static NOINLINE void allocate_dead_nodes(int count)
+{
+    for(int i = 0; i < count; ++i) {
+        Pointer<Node> dead = new Node(i);
+    }
+}
+
+
+//dead objects are finalized after the pause of the collection that finds
+//them, not inside it
+static void test_finalizers()
+{
+    allocate_dead_nodes(100);
+    finalized_at_report = -1;
+    setCollectionCallback(report_finalized);
+    scrub();
+    collectGarbage();
+    setCollectionCallback(0);
+    CHECK(finalized_at_report == 0);
+    CHECK(finalized == 100);
+    CHECK(getStats().pendingFinalizers == 0);
+}
+
+
+#if GC_MULTITHREADED == 1
+//heap that the thread a finalizer starts allocates in; the finalizer does
+//not start it once the test is over
+static Heap *finalizer_heap = 0;
+
+
+//set once the thread a finalizer starts has allocated
+static volatile int finalizer_allocated = 0;
+
+
+//thread a finalizer starts; it is joined after the finalizer returns
+#ifdef WIN32
+static HANDLE finalizer_thread;
+#else
+static pthread_t finalizer_thread;
+#endif
+static bool finalizer_started = false;
+
+
+//allocates an object in the heap it is given
+#ifdef WIN32
+static DWORD CALLBACK allocate_proc(LPVOID heap)
+#else
+static void *allocate_proc(void *heap)
+#endif
+{
+    HeapScope scope(*(Heap *)heap);
+    Pointer<Cell> cell = new Cell(1);
+    finalizer_allocated = 1;
+    return 0;
+}
+
+
+//object whose finalizer waits for another thread to allocate in its heap;
+//the thread would block until the finalizer returns if the heap were locked
+struct Waiter : Object {
+    ~Waiter() {
+        if (!finalizer_heap) return;
+#ifdef WIN32
+        finalizer_thread = CreateThread(0, 0, allocate_proc, finalizer_heap, 0, 0);
+#else
+        pthread_create(&finalizer_thread, NULL, allocate_proc, finalizer_heap);
+#endif
+        finalizer_started = true;
+        time_t deadline = time(0) + 5;
+        while (!finalizer_allocated && time(0) < deadline) {
+        }
+    }
+};
+
+
+//allocate a waiter that dies at once
+static NOINLINE void allocate_dead_waiter()
+{
+    Pointer<Waiter> dead = new Waiter;
+}
+
+
+//finalizers run without the lock of the heap
+static void test_finalizers_unlocked()
+{
+    finalizer_heap = Heap::bind(0);
+    Heap::bind(finalizer_heap);
+    finalizer_allocated = 0;
+    finalizer_started = false;
+    allocate_dead_waiter();
+    scrub();
+    collectGarbage();
+    CHECK(finalizer_started && finalizer_allocated);
+    if (finalizer_started) {
+#ifdef WIN32
+        WaitForSingleObject(finalizer_thread, INFINITE);
+        CloseHandle(finalizer_thread);
+#else
+        pthread_join(finalizer_thread, NULL);
+#endif
+    }
+    finalizer_heap = 0;
+}
+#endif
+
+
+//object without finalization whose destructor counts as a finalization
+struct Trivial : TrivialObject {
+    ~Trivial() {
+        ++finalized;
+    }
+};
+
+
+//a trivial object is freed without running its destructor
+static void test_trivial()
+{
+    for(int i = 0; i < 100; ++i) {
+        Pointer<Trivial> dead = new Trivial;
+    }
+    collectGarbage();
+    CHECK(finalized == 0);
+}
+
+
+//pointer that a finalizer stores the object it reaches into
+static Pointer<Cell> *rescued = 0;
+
+
+//value of the object a finalizer reached
+static int reached = 0;
+
+
+//object whose finalizer uses the object it points to, and keeps it
+struct Owner : Object {
+    Pointer<Cell> cell;
+
+    ~Owner() {
+        reached = cell->value;
+        if (rescued) *rescued = cell;
+    }
+};
+
+
+//allocate an owner that dies at once
+static NOINLINE void allocate_dead_owner()
+{
+    Pointer<Owner> owner = new Owner;
+    owner->cell = new Cell(7);
+}
+
+
+//the objects that a dead object reaches are intact while it is finalized,
+//and its finalizer can make them reachable again
+static void test_resurrection()
+{
+    Pointer<Cell> rescue;
+    rescued = &rescue;
+    reached = 0;
+    allocate_dead_owner();
+    scrub();
+    churn();
+    collectGarbage();
+    runFinalizers();
+    CHECK(reached == 7);
+    churn();
+    collectGarbage();
+    CHECK(rescue && rescue->value == 7);
+    rescued = 0;
+}
+
+
+/*****************************************************************************
+    WEAK POINTERS
+ *****************************************************************************/
+
+
+//point a weak root to an object that dies at once
+static NOINLINE void point_to_dead(WeakPointer<Node> &weak)
+{
+    weak = new Node(2);
+}
+
+
+//point a weak root to an object that lives while the collections move it,
+//and that dies afterwards
+static NOINLINE void point_to_live(WeakPointer<Node> &weak)
+{
+    Pointer<Node> strong = new Node(1);
+    weak = strong;
+    churn();
+    CHECK(weak.get() == strong() && weak->value == 1);
+    collectGarbage();
+    CHECK(weak.get() == strong() && weak->value == 1);
+}
+
+
+//weak roots are cleared when their objects die, and follow them else
+static void test_weak()
+{
+    WeakPointer<Node> dead;
+    point_to_dead(dead);
+    scrub();
+    churn();
+    CHECK(dead.expired());
+    WeakPointer<Node> live;
+    point_to_live(live);
+    scrub();
+    collectGarbage();
+    CHECK(live.expired());
+    CHECK(getStats().clearedWeakPointers >= 2);
+}
+
+
+//object with a weak member
+struct Watcher : TrivialObject {
+    WeakPointer<Cell> watched;
+};
+
+
+//make a watcher watch a young object while it is promoted, and that dies
+//afterwards
+static NOINLINE void watch_promoted(Watcher *watcher)
+{
+    Pointer<Cell> cell = new Cell(3);
+    watcher->watched = cell;
+    churn();
+    CHECK(watcher->watched.get() == cell() && watcher->watched->value == 3);
+}
+
+
+//a weak member of an old object follows its young object when it is
+//promoted, and it is cleared when the object dies
+static void test_weak_member()
+{
+    Pointer<Watcher> watcher = new Watcher;
+    collectGarbage();
+    watch_promoted(watcher);
+    scrub();
+    churn();
+    collectGarbage();
+    CHECK(watcher->watched.expired());
+}
+
+
+/*****************************************************************************
+    OBJECT KINDS
+ *****************************************************************************/
+
+
+//object whose pointers are found by its pointer map
+struct Mapped : MappedObject<Mapped, TrivialObject> {
+    Pointer<Mapped> next;
+    WeakPointer<Mapped> prev;
+    int value;
+
+    static const size_t *pointerMap() {
+        static const size_t map[] = { pointerOffset(&Mapped::next), pointerOffset(&Mapped::prev), 0 };
+        return map;
+    }
+};
+
+
+//the pointers of mapped objects keep and follow their objects
+static void test_mapped()
+{
+    Pointer<Mapped> head;
+    for(int i = 0; i < 1000; ++i) {
+        Pointer<Mapped> node = new Mapped;
+        node->value = i;
+        node->next = head;
+        if (head) head->prev = node;
+        head = node;
+    }
+    churn();
+    collectGarbage();
+    int count = 1000;
+    for(Mapped *node = head; node; node = node->next) {
+        CHECK(node->value == --count);
+        CHECK(!node->next || node->next->prev.get() == node);
+    }
+    CHECK(count == 0);
+}
+
+
+//arrays of items are not scanned; arrays of pointers keep their objects
+static void test_arrays()
+{
+    Pointer<Array<int> > ints = Array<int>::create(100);
+    Pointer<PointerArray<Cell> > ptrs = PointerArray<Cell>::create(100);
+    for(int i = 0; i < 100; ++i) {
+        (*ints)[i] = i;
+        (*ptrs)[i] = new Cell(i);
+    }
+    churn();
+    collectGarbage();
+    for(int i = 0; i < 100; ++i) {
+        CHECK((*ints)[i] == i);
+        CHECK((*ptrs)[i]->value == i);
+    }
+    CHECK(!Array<char>::create((size_t)-1 / 2));
+}
+
+
+//finalized leaf
+struct Vector {
+    double x, y;
+
+    ~Vector() {
+        ++finalized;
+    }
+};
+
+
+//allocate a finalized leaf and one that is not, which die at once
+static NOINLINE void allocate_dead_leaves()
+{
+    LeafPointer<Vector> dead = newLeaf<Vector>(true);
+    LeafPointer<Vector> untouched = newLeaf<Vector>(false);
+}
+
+
+//leaves keep their contents, and the finalized ones are destroyed when
+//they die
+static void test_leaves()
+{
+    LeafPointer<char> text = (char *)allocateLeaf(6);
+    strcpy(text, "hello");
+    LeafPointer<Vector> vector = newLeaf<Vector>(true);
+    vector->x = 1;
+    allocate_dead_leaves();
+    scrub();
+    churn();
+    collectGarbage();
+    CHECK(!strcmp(text, "hello") && vector->x == 1);
+    CHECK(finalized == 1);
+}
+
+
+/*****************************************************************************
+    OLD GENERATION
+ *****************************************************************************/
+
+
+//unlink every other cell of a list
+static NOINLINE void unlink_odd(Cell *cell)
+{
+    for(; cell && cell->next; cell = cell->next) cell->next = cell->next->next;
+}
+
+
+//full collections free the dead old objects and keep the live ones intact,
+//whether they move or not
+static void test_full()
+{
+    Pointer<Cell> list = cells(2000);
+    collectGarbage();
+    size_t old = getStats().oldObjects;
+    unlink_odd(list);
+    scrub();
+    CHECK(collectGarbage() >= 1000 * sizeof(Cell));
+    Stats stats = getStats();
+    CHECK(stats.oldObjects == old - 1000);
+    CHECK(stats.last.full && stats.last.freedBytes > 0);
+    int count = 0;
+    for(Cell *cell = list; cell; cell = cell->next, count += 2) CHECK(cell->value == 1999 - count);
+    CHECK(count == 2000);
+}
+
+
+//object of the large object space
+struct Big : TrivialObject {
+    char data[100000];
+};
+
+
+//allocate a big object that dies at once
+static NOINLINE void allocate_dead_big()
+{
+    Pointer<Big> dead = new Big;
+}
+
+
+//big objects live in the large object space, which is swept; they do not
+//move
+static void test_large()
+{
+    Pointer<Big> big = new Big;
+    memset(big->data, 7, sizeof(big->data));
+    Big *address = big;
+    allocate_dead_big();
+    scrub();
+    CHECK(getStats().largeObjects == 2);
+    CHECK(collectGarbage() >= sizeof(Big));
+    CHECK(getStats().largeObjects == 1);
+    CHECK(big() == address);
+    CHECK(big->data[0] == 7 && big->data[sizeof(big->data) - 1] == 7);
+}
+
+
+//object of a few kilobytes
+struct Chunk : Object {
+    Pointer<Chunk> next;
+    char data[2000];
+};
+
+
+//the old generation grows beyond its initial size for a live set that
+//needs it
+static void test_growth()
+{
+    int count = (int)(GC_MEMORY_SIZE / sizeof(Chunk)) * 3 / 2;
+    Pointer<Chunk> head;
+    for(int i = 0; i < count; ++i) {
+        Pointer<Chunk> chunk = new Chunk;
+        chunk->data[0] = (char)i;
+        chunk->next = head;
+        head = chunk;
+    }
+    collectGarbage();
+    bool ok = true;
+    for(Chunk *chunk = head; chunk; chunk = chunk->next) ok = ok && chunk->data[0] == (char)--count;
+    CHECK(ok && count == 0);
+}
+
+
+#if GC_MARK_SWEEP == 1
+//the old objects do not move, and the objects that are promoted later take
+//the cells of the dead ones
+static void test_sweep()
+{
+    Pointer<Cell> list = cells(2000);
+    collectGarbage();
+    std::vector<Cell *> live, dead;
+    int count = 0;
+    for(Cell *cell = list; cell; cell = cell->next, ++count) (count % 2 ? dead : live).push_back(cell);
+    unlink_odd(list);
+    scrub();
+    collectGarbage();
+    size_t index = 0;
+    for(Cell *cell = list; cell; cell = cell->next, ++index) CHECK(index < live.size() && cell == live[index]);
+    CHECK(index == live.size());
+    Pointer<Cell> promoted = cells(1000);
+    collectGarbage();
+    std::sort(dead.begin(), dead.end());
+    int reused = 0;
+    for(Cell *cell = promoted; cell; cell = cell->next) reused += std::binary_search(dead.begin(), dead.end(), cell);
+    CHECK(reused == 1000);
+    CHECK(intact(promoted, 1000));
+}
+#endif
+
+
+/*****************************************************************************
+    STATISTICS
+ *****************************************************************************/
+
+
+//collections that count_collection() was called after
+static int reported = 0;
+
+
+//counts the collections it is called after, and keeps the last record
+static void count_collection(const CollectionStats &stats, void *data)
+{
+    CollectionStats *last = (CollectionStats *)data;
+    *last = stats;
+    ++reported;
+}
+
+
+//each collection is reported once, and its pause is counted once
+static void test_stats()
+{
+    Pointer<Cell> *list = new Pointer<Cell>(cells(1000));
+    CollectionStats last;
+    reported = 0;
+    setCollectionCallback(count_collection, &last);
+    collectGarbage();
+    setCollectionCallback(0);
+    Stats stats = getStats();
+    CHECK(reported == 1 && last.full);
+    CHECK(stats.last.full && stats.last.liveBytes == last.liveBytes);
+    CHECK(stats.oldObjects + stats.youngObjects == 1000 && stats.roots >= 1);
+    size_t pauses = 0;
+    for(int i = 0; i < Stats::PAUSE_BUCKETS; ++i) pauses += stats.pauseHistogram[i];
+    CHECK(pauses == stats.pauses);
+    CHECK(stats.maxPauseMicros <= stats.pauseMicros);
+    delete list;
+}
+
+
+//a full collection is done once the old objects grow by the configured
+//share of the bytes that survived the last one, and not before
+static void test_pacing()
+{
+    Pointer<Cell> list = cells(1000);
+    collectGarbage();
+    Stats stats = getStats();
+    CHECK(stats.triggerBytes >= GC_MIN_TRIGGER_SIZE);
+    CHECK(stats.growthPercent >= GC_GROWTH_PERCENT);
+    size_t collections = stats.collections;
+    bool early = false;
+    for(int i = 0; i < 1000 && getStats().collections == collections; ++i) {
+        stats = getStats();
+        early = early || stats.oldBytes + stats.largeBytes >= stats.triggerBytes;
+        Pointer<Cell> promoted = cells(1000);
+        churn();
+    }
+    CHECK(!early && getStats().collections > collections);
+    CHECK(intact(list, 1000));
+}
+
+
+/*****************************************************************************
+    HEAPS
+ *****************************************************************************/
+
+
+//heaps are collected independently, and a deleted heap finalizes its
+//objects
+static void test_heaps()
+{
+    {
+        Heap heap;
+        {
+            Heap *prev = Heap::bind(&heap);
+            Pointer<Node> node = new Node(9);
+            for(int i = 0; i < 10; ++i) new Node(i);
+            Heap::bind(prev);
+            churn();
+            collectGarbage();
+            CHECK(heap.getStats().collections == 0 && heap.getStats().minorCollections == 0);
+            CHECK(finalized == 0);
+            heap.collectGarbage();
+            CHECK(heap.getStats().collections == 1);
+            CHECK(node->value == 9);
+        }
+    }
+    CHECK(finalized == 11);
+}
+
+
+//make roots of the thread point to objects of another heap, which keep
+//them while both heaps are collected, and that die afterwards
+static NOINLINE void point_across(Heap &other)
+{
+    Pointer<Node> copied, assigned;
+    {
+        HeapScope scope(other);
+        Pointer<Node> node = new Node(42);
+        copied = node;
+        assigned = new Node(7);
+    }
+    Pointer<Node> constructed(copied);
+    churn();
+    collectGarbage();
+    other.collectGarbage();
+    CHECK(copied->value == 42 && constructed == copied);
+    CHECK(assigned->value == 7);
+    CHECK(finalized == 0);
+}
+
+
+//a root belongs to the heap of its object, whichever heap the thread is
+//bound to when it is constructed or assigned
+static void test_cross_heap()
+{
+    Heap other;
+    point_across(other);
+    scrub();
+    other.collectGarbage();
+    Stats stats = other.getStats();
+    CHECK(stats.oldObjects + stats.youngObjects == 0);
+    CHECK(finalized == 2);
+}
+
+
+/*****************************************************************************
+    ROOTS
+ *****************************************************************************/
+
+
+//the slots of roots that are destroyed out of order are reused, so as that
+//the root stack does not grow with them
+static void test_root_holes()
+{
+    Pointer<Cell> *window[1000];
+    for(int i = 0; i < 1000; ++i) window[i] = new Pointer<Cell>(new Cell(i));
+    for(int i = 1000; i < 100000; ++i) {
+        delete window[i % 1000];
+        window[i % 1000] = new Pointer<Cell>(new Cell(i));
+    }
+    Stats stats = getStats();
+    CHECK(stats.roots == 1000);
+    CHECK(stats.rootSlots <= 4096);
+    for(int i = 0; i < 1000; ++i) {
+        CHECK((*window[i])->value == 99000 + i);
+        delete window[i];
+    }
+}
+
+
+#if GC_MOVE_SEMANTICS == 1
+//a moved root takes over its source, which is null afterwards
+static void test_move()
+{
+    Pointer<Cell> source = new Cell(5);
+    size_t roots = getStats().roots;
+    Pointer<Cell> target(static_cast<Pointer<Cell> &&>(source));
+    CHECK(!source && target->value == 5);
+    CHECK(getStats().roots == roots);
+    Pointer<Cell> other;
+    other = static_cast<Pointer<Cell> &&>(target);
+    CHECK(!target && other->value == 5);
+    churn();
+    collectGarbage();
+    CHECK(other->value == 5);
+}
+
+
+//roots that a container moves around keep their slots, so the root stack
+//does not grow
+static void test_move_container()
+{
+    std::vector<Pointer<Cell> > cells;
+    cells.reserve(1000);
+    for(int i = 0; i < 1000; ++i) cells.push_back(new Cell(i));
+    size_t slots = getStats().rootSlots;
+    for(int i = 0; i < 100; ++i) {
+        std::reverse(cells.begin(), cells.end());
+        std::rotate(cells.begin(), cells.begin() + 1, cells.end());
+    }
+    Stats stats = getStats();
+    CHECK(stats.roots == 1000);
+    CHECK(stats.rootSlots == slots);
+    churn();
+    collectGarbage();
+    for(int i = 0; i < 1000; ++i) CHECK(cells[i]->value == i);
+}
+#endif
+
+
+#if GC_CONSERVATIVE == 1
+//objects that only words of the stack point into are kept
+static void test_conservative()
+{
+    Cell *raw = cells(100);
+    int *inner = &cells(1)->value;
+    churn();
+    collectGarbage();
+    CHECK(intact(raw, 100));
+    CHECK(*inner == 0);
+}
+#endif
+
+
+#if GC_MULTITHREADED == 1
+/*****************************************************************************
+    THREADS
+ *****************************************************************************/
+
+
+//threads of test_threads(), and objects that each one keeps
+#define THREADS              4
+#define THREAD_OBJECTS       1000
+
+
+//keeps new objects in an array of roots, between garbage
+#ifdef WIN32
+static DWORD CALLBACK keep_proc(LPVOID roots)
+#else
+static void *keep_proc(void *roots)
+#endif
+{
+    Pointer<Cell> *kept = (Pointer<Cell> *)roots;
+    for(int i = 0; i < THREAD_OBJECTS; ++i) {
+        kept[i] = new Cell(i);
+        for(int j = 0; j < 100; ++j) {
+            Pointer<Cell> garbage = new Cell(-1);
+        }
+    }
+    return 0;
+}
+
+
+//threads allocate from buffers of their own, and the collections that
+//their allocations trigger keep the objects of all of them
+static void test_threads()
+{
+    static Pointer<Cell> kept[THREADS][THREAD_OBJECTS];
+#ifdef WIN32
+    HANDLE threads[THREADS];
+    for(int t = 0; t < THREADS; ++t) threads[t] = CreateThread(0, 0, keep_proc, kept[t], 0, 0);
+    for(int t = 0; t < THREADS; ++t) {
+        WaitForSingleObject(threads[t], INFINITE);
+        CloseHandle(threads[t]);
+    }
+#else
+    pthread_t threads[THREADS];
+    for(int t = 0; t < THREADS; ++t) pthread_create(&threads[t], NULL, keep_proc, kept[t]);
+    for(int t = 0; t < THREADS; ++t) pthread_join(threads[t], NULL);
+#endif
+    for(int t = 0; t < THREADS; ++t) {
+        for(int i = 0; i < THREAD_OBJECTS; ++i) {
+            CHECK(kept[t][i]->value == i);
+            kept[t][i] = 0;
+        }
+    }
+}
+
+
+//heap of the mutator of test_mutators()
+static Heap *mutator_heap = 0;
+
+
+//progress of the mutator: it is ready once its objects are allocated, it
+//allocates until the first collections of the other thread are done, and it
+//waits in a safe region until the last one is
+static volatile int mutator_ready = 0;
+static volatile int mutator_done = 0;
+static volatile int mutator_safe = 0;
+static volatile int mutator_released = 0;
+
+
+//set if the objects of the mutator were intact
+static bool mutator_intact = false;
+
+
+//registered mutator whose objects its roots point to, and in a conservative
+//collector also raw pointers on its stack; it stops at its allocations
+//while the other thread collects, and then lets it collect from a safe
+//region
+#ifdef WIN32
+static DWORD CALLBACK mutator_proc(LPVOID)
+#else
+static void *mutator_proc(void *)
+#endif
+{
+    HeapScope scope(*mutator_heap);
+    MutatorScope mutator;
+#if GC_CONSERVATIVE == 1
+    Cell *raw = cells(100);
+#endif
+    Pointer<Cell> list = cells(100);
+    mutator_ready = 1;
+    while (!mutator_done) {
+        Pointer<Cell> garbage = new Cell(-1);
+    }
+    {
+        SafeRegion region;
+        mutator_safe = 1;
+        while (!mutator_released) {
+        }
+    }
+    mutator_intact = intact(list, 100);
+#if GC_CONSERVATIVE == 1
+    mutator_intact = mutator_intact && intact(raw, 100);
+#endif
+    return 0;
+}
+
+
+//a collection stops the registered mutators at their safepoints, and does
+//not wait for the ones in a safe region
+static void test_mutators()
+{
+    mutator_heap = Heap::bind(0);
+    Heap::bind(mutator_heap);
+    mutator_ready = mutator_done = mutator_safe = mutator_released = 0;
+    mutator_intact = false;
+#ifdef WIN32
+    HANDLE thread = CreateThread(0, 0, mutator_proc, 0, 0, 0);
+#else
+    pthread_t thread;
+    pthread_create(&thread, NULL, mutator_proc, 0);
+#endif
+    while (!mutator_ready) {
+    }
+    for(int i = 0; i < 5; ++i) {
+        churn();
+        collectGarbage();
+    }
+    mutator_done = 1;
+    while (!mutator_safe) {
+    }
+    churn();
+    collectGarbage();
+    mutator_released = 1;
+#ifdef WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+    CHECK(mutator_intact);
+}
+#endif
+
+
+/*****************************************************************************
+    MAIN
+ *****************************************************************************/
+
+
+//a test
+struct Test {
+    const char *name;
+    void (*run)();
+};
+
+
+//the tests, in order
+static const Test tests[] = {
+    { "young", test_young },
+    { "incremental", test_incremental },
+    { "delete_marking", test_delete_marking },
+    { "locked", test_locked },
+    { "tree", test_tree },
+    { "deep", test_deep },
+    { "members", test_members },
+    { "finalizers", test_finalizers },
+    { "finalizer_collects", test_finalizer_collects },
+#if GC_MULTITHREADED == 1
+    { "finalizers_unlocked", test_finalizers_unlocked },
+#endif
+    { "trivial", test_trivial },
+    { "resurrection", test_resurrection },
+    { "weak", test_weak },
+    { "weak_member", test_weak_member },
+    { "mapped", test_mapped },
+    { "arrays", test_arrays },
+    { "leaves", test_leaves },
+    { "full", test_full },
+    { "large", test_large },
+    { "growth", test_growth },
+#if GC_MARK_SWEEP == 1
+    { "sweep", test_sweep },
+#endif
+    { "root_holes", test_root_holes },
+#if GC_MOVE_SEMANTICS == 1
+    { "move", test_move },
+    { "move_container", test_move_container },
+#endif
+#if GC_CONSERVATIVE == 1
+    { "conservative", test_conservative },
+#endif
+    { "stats", test_stats },
+    { "pacing", test_pacing },
+    { "heaps", test_heaps },
+    { "cross_heap", test_cross_heap },
+#if GC_MULTITHREADED == 1
+    { "threads", test_threads },
+    { "mutators", test_mutators },
+#endif
+};
+
+
+//runs a test in a heap of its own
+static bool run(const Test &test)
+{
+    HeapConfig config;
+    config.nurserySize = TEST_NURSERY_SIZE;
+    failures = 0;
+    finalized = 0;
+    {
+        Heap heap(config);
+        HeapScope scope(heap);
+
+        //the words that the earlier tests left on the stack may point into
+        //the new heap
+        scrub();
+        test.run();
+    }
+    printf("%s %s\n", failures ? "FAIL" : "ok", test.name);
+    return !failures;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+    size_t count = sizeof(tests) / sizeof(tests[0]);
+    for(size_t i = 0; i < count; ++i) {
+        bool selected = argc < 2;
+        for(int a = 1; a < argc && !selected; ++a) selected = !strcmp(argv[a], tests[i].name);
+        if (selected && !run(tests[i])) ++failed;
+    }
+    return failed;
+}